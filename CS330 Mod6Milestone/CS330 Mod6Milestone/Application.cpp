@@ -11,24 +11,91 @@
 	ScrollWheel -					[Control speed of movement]
 	E -								[Increase camera's Z axis]
 	Q -								[Decrease camera's Z axis]
-	P -								[*Sensitive to press* Changes Projection]
+	P -								[Changes Projection]
+	R -								[Turns the Rubik's cube a quarter turn on the book]
+	Escape -						[Closes the window]
 	Arrow Keys -                    [Controls light source's X and Y axis]
 	Right shift and Right CTRL -    [Controls Light source's Z axis]
 
+	Options:
+	--headless [frames] -			[Renders the given number of frames (300 by default) offscreen in a hidden window, then exits]
+	--tick-test [seconds] -			[Runs the threaded loop in a hidden window for the given time (3 by default) with slow frames,
+									 and fails unless input was still sampled at the simulation rate]
+	--render-delay <ms> -			[Adds a sleep to every render thread frame, standing in for a slow frame]
+	--dump <prefix> -				[With --headless, writes every frame to <prefix>00000.ppm, <prefix>00001.ppm, ...]
+	--benchmark [frames] -			[Flies a camera path for the given number of frames (1000 by default) and reports frame time percentiles as JSON]
+	--path <file> -					[Camera path the benchmark follows instead of the built-in orbit]
+	--report <file> -				[Where the benchmark writes its JSON report, the console by default]
+	--record <file> -				[Writes the camera and light of every simulation tick to a path file --path can replay]
+	--gpu-timers -					[Times the clear, each draw and the swap on the GPU and reports rolling averages]
+	--trace <file> -				[Writes the CPU zones and timed GPU scopes as a Chrome trace (chrome://tracing) on exit,
+									 or whenever SIGUSR1 (Ctrl+Break on Windows) arrives]
+	--log <file> -					[Writes messages to the file instead of the console]
+	--log-level <level> -			[Least severe messages shown: debug, info (default), warning or error]
+	--latency -						[Reports input-to-swap and input-to-GPU-done latency percentiles of the interactive window]
+	--late-latch -					[Rewrites the view matrix with the newest mouse look just before the draws are submitted]
+	--idle -						[Only redraws when something changed, blocking for events while the scene is still,
+									 and reports what caused the redraws]
+	--vsync <mode> -				[Swap interval: on (default), off or adaptive (tears instead of waiting when a frame is late).
+									 The benchmark runs with vsync off unless this is given]
+	--fps <rate> -					[Caps the frame rate, pacing frames with a sleep followed by a short spin]
+	--shader-cache <prefix> -		[Where linked programs are cached, as <prefix><hash>.bin; shadercache_ by default]
+	--no-shader-cache -				[Compiles every program from source, neither reading nor writing the cache]
+	--bind <action>=<key> -			[Binds a key to an action, e.g. --bind forward=UP. Actions: quit, forward, back, right, left,
+									 down, up, light-left, light-right, light-up, light-down, light-near, light-far, projection, turn-cube.
+									 Keys: a letter or digit, a name such as LEFT, SPACE or RIGHT_SHIFT, or a GLFW key code]
+
 	Todo: Separate shaders, VBOs, camera, etc... into their own classes for readability
 
 */
 
 // including libraries
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <csignal>
 #include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+// Trace zones read the time stamp counter where there is one, far cheaper than a system clock call
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_HAS_TSC 1
+#endif
+
 // GLM Math Headers
+// Intrinsics let the frustum extension test bounding boxes 4 or 8 at a time
+#define GLM_FORCE_INTRINSICS
 #include <glm/glm.hpp>
+#include <glm/ext/frustum.hpp>
+#include <glm/ext/matrix_compose.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/spline.hpp>
 
 // STB_IMAGE
 #define STB_IMAGE_IMPLEMENTATION
@@ -50,13 +117,86 @@ namespace
 	const int WINDOW_WIDTH = 800;
 	const int WINDOW_HEIGHT = 600;
 
+	// Named range of the vertex buffer drawn as one object, with the texture unit it samples.
+	// The unit is also the object's layer in the batched path's texture array
+	struct GLSubmesh
+	{
+		const char* name;
+		GLint first;
+		GLsizei count;
+		GLint textureUnit;
+		// Object-space bounding box of the range's vertices
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		// Transform node the range is drawn with, assigned by UCreateScene
+		uint32_t node;
+	};
+
 	// Declaring unsigned ints for vertex array and buffer, as well as number of indices
 	struct GLMesh
 	{
 		GLuint vao;
 		GLuint vbo;
 		GLuint nIndices;
+		// Draw ranges, one per object, that never overlap
+		std::vector<GLSubmesh> submeshes;
+	};
+
+	// Active uniform reflected from a linked program
+	struct GLUniform
+	{
+		GLint location;
+		GLenum type;
+		GLint size;
+	};
+
+	// Active uniform block reflected from a linked program
+	struct GLUniformBlock
+	{
+		GLuint index;
+		GLint binding;
+		GLint dataSize;
+	};
+
+	// Linked shader program, with every active uniform resolved once at link time
+	struct GLProgram
+	{
+		GLuint id;
+		std::unordered_map<std::string, GLUniform> uniforms;
+		std::unordered_map<std::string, GLUniformBlock> blocks;
+	};
+
+	// Uniform handles pushed by URender for every draw
+	struct ObjectUniforms
+	{
+		GLint model, uTexture;
+	};
+
+	// Binding point of the FrameBlock uniform block, fixed in every shader
+	const GLuint FRAME_BLOCK_BINDING = 0;
+
+	// CPU mirror of the std140 FrameBlock declared in the shaders.
+	// vec3 members take 16 bytes in std140, hence the explicit padding
+	struct FrameConstants
+	{
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::vec3 viewPosition; float pad0;
+		glm::vec3 lightPos; float pad1;
+		// Light struct
+		glm::vec3 lightPosition; float pad2;
+		glm::vec3 lightAmbient; float pad3;
+		glm::vec3 lightDiffuse; float pad4;
+		glm::vec3 lightSpecular;
+		float lightConstant;
+		float lightLinear;
+		float lightQuadratic;
+		float pad5[2];
 	};
+	static_assert(offsetof(FrameConstants, viewPosition) == 128, "FrameConstants must match std140 layout");
+	static_assert(offsetof(FrameConstants, lightPosition) == 160, "FrameConstants must match std140 layout");
+	static_assert(offsetof(FrameConstants, lightConstant) == 220, "FrameConstants must match std140 layout");
+	static_assert(sizeof(FrameConstants) == 240, "FrameConstants must match std140 layout");
 
 	// defining main window
 	GLFWwindow* gWindow = nullptr;
@@ -65,16 +205,347 @@ namespace
 	// Texture IDs
 	GLuint texture0, texture1, texture2, texture3;
 	// defining both shader programs
-	GLuint gProgramId;
+	GLProgram gProgram;
+	// Handles into gProgram's uniform table
+	ObjectUniforms gObjectUniforms;
+
+	// Set by --shader-cache and --no-shader-cache: file name prefix of the program binary cache, nullptr to always compile
+	const char* gShaderCachePrefix = "shadercache_";
+
+	// Start of a cached program binary file, followed by length bytes of binary in the given format
+	const char PROGRAM_CACHE_MAGIC[4] = { 'S', 'P', 'B', 'C' };
+	const uint32_t PROGRAM_CACHE_VERSION = 1;
+	struct ProgramCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	// What program creation cost at startup, reported once everything is ready
+	struct ProgramCacheStats
+	{
+		unsigned hits;
+		unsigned misses;
+		uint64_t nanoseconds;
+	};
+	ProgramCacheStats gProgramCacheStats;
+
+	// Frames the CPU may run ahead of the GPU, each with its own region of the stream buffer
+	const unsigned STREAM_FRAME_COUNT = 3;
+	// Largest offset alignment drivers ask of uniform and storage buffer ranges, reserved per allocation when sizing regions
+	const GLsizeiptr STREAM_ALIGNMENT_RESERVE = 256;
+
+	// Persistently mapped buffer for everything rewritten each frame, split into one region per
+	// frame in flight. The CPU fills the current region with plain memcpy while the GPU reads the
+	// others, and a fence per region says when the GPU is done with it, so no update ever waits
+	// on the driver's implicit synchronization
+	struct StreamBuffer
+	{
+		GLuint buffer;
+		unsigned char* mapped;
+		GLsizeiptr regionSize;
+		GLint alignment;
+		unsigned region;
+		// Bytes handed out from the current region
+		GLsizeiptr offset;
+		GLsync fences[STREAM_FRAME_COUNT];
+		// Fence waits that actually blocked since the last report, printed every STATE_REPORT_INTERVAL seconds
+		unsigned reportStalls, reportFrames;
+		double reportWaitSeconds, lastReportTime;
+	};
+
+	// Holds FrameConstants, the stress instance matrices and their indirect command
+	StreamBuffer gStream;
+
+	// Scene textures, in texture unit order (unit 0 is marble, 1 the book, ...)
+	const int TEXTURE_COUNT = 4;
+	const char* const TEXTURE_FILES[TEXTURE_COUNT] = {
+		"../CS330 Mod6Milestone/Resources/Textures/marble.jfif",
+		"../CS330 Mod6Milestone/Resources/Textures/gulagArchipelago.png",
+		"../CS330 Mod6Milestone/Resources/Textures/rubikscube.png",
+		"../CS330 Mod6Milestone/Resources/Textures/dust.jpg",
+	};
+
+	// Layout of one command in a GL_DRAW_INDIRECT_BUFFER for glMultiDrawArraysIndirect
+	struct DrawArraysIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+
+	// Whole scene submitted with one indirect multi-draw. Every texture is a layer of one
+	// texture array, and each draw's layer comes from a per-instance attribute fetched at
+	// its baseInstance, so nothing changes between draws
+	struct GLBatch
+	{
+		GLuint vao;
+		GLuint layerVbo;
+		GLuint indirectBuffer;
+		GLuint textureArray;
+		GLuint modelBuffer;
+		GLsizei drawCount;
+	};
+
+	// Binding point of the DrawBlock shader storage block holding the batched draws' model matrices
+	const GLuint DRAW_BLOCK_BINDING = 4;
+
+	// Width and height every texture is resampled to when packed into the texture array
+	const GLsizei TEXTURE_ARRAY_SIZE = 1024;
+	// Texture unit the texture array is bound to
+	const GLuint TEXTURE_ARRAY_UNIT = 4;
+
+	// Texture units, texture targets, buffer targets and capabilities shadowed by the state cache
+	const int MAX_TEXTURE_UNITS = 8;
+	enum TextureTarget { TEXTURE_TARGET_2D, TEXTURE_TARGET_2D_ARRAY, TEXTURE_TARGET_COUNT };
+	enum BufferTarget { BUFFER_TARGET_ARRAY, BUFFER_TARGET_UNIFORM, BUFFER_TARGET_DRAW_INDIRECT, BUFFER_TARGET_SHADER_STORAGE, BUFFER_TARGET_COPY_READ, BUFFER_TARGET_COPY_WRITE, BUFFER_TARGET_COUNT };
+	enum Capability { CAPABILITY_DEPTH_TEST, CAPABILITY_CULL_FACE, CAPABILITY_BLEND, CAPABILITY_COUNT };
+
+	// Value meaning "not known yet", so the next call is always forwarded to GL
+	const GLuint UNKNOWN_BINDING = 0xFFFFFFFFu;
+
+	// Shadow copy of the GL state the app changes. Every bind/enable/clear color call in this
+	// file goes through UState* so calls that would not change anything never reach the driver
+	struct GLStateCache
+	{
+		GLuint program;
+		GLuint vao;
+		GLuint activeUnit;
+		GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+		GLuint buffers[BUFFER_TARGET_COUNT];
+		GLint enabled[CAPABILITY_COUNT]; // -1 unknown, 0 disabled, 1 enabled
+		glm::vec4 clearColor;
+		bool clearColorKnown;
+
+		// Calls forwarded and skipped during the current frame
+		unsigned frameIssued, frameElided;
+		// Totals since the last report, printed every STATE_REPORT_INTERVAL seconds
+		unsigned long long reportIssued, reportElided, reportFrames;
+		double lastReportTime;
+	};
+
+	const double STATE_REPORT_INTERVAL = 5.0;
+
+	GLStateCache gState;
+
+	// Render passes, in submission order
+	enum RenderPass { PASS_OPAQUE, PASS_TRANSPARENT };
+
+	// Sort key layout, most significant bits first:
+	// pass (2) | program (8) | texture (8) | VAO (8) | depth (24) | unused (14).
+	// Program, texture and VAO fields hold the low bits of the GL name or unit; two objects
+	// sharing those bits only cost an extra state change, never a wrong draw
+	const int SORT_KEY_PASS_SHIFT = 62;
+	const int SORT_KEY_PROGRAM_SHIFT = 54;
+	const int SORT_KEY_TEXTURE_SHIFT = 46;
+	const int SORT_KEY_VAO_SHIFT = 38;
+	const int SORT_KEY_DEPTH_SHIFT = 14;
+	const uint32_t SORT_KEY_DEPTH_MAX = (1u << 24) - 1;
+
+	// Everything needed to submit one draw, independent of submission order
+	struct DrawItem
+	{
+		// Submesh name, labelling the draw's GPU timer scope
+		const char* name;
+		GLuint program;
+		GLint modelLoc;
+		GLint textureLoc;
+		GLuint vao;
+		GLint textureUnit;
+		GLint first;
+		GLsizei count;
+		glm::mat4 model;
+	};
+
+	// Key and item index pair, the only thing the radix sort moves around
+	struct SortEntry
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+
+	// Draws collected for the frame, sorted by key before submission
+	struct RenderQueue
+	{
+		std::vector<DrawItem> items;
+		std::vector<SortEntry> entries;
+		std::vector<SortEntry> scratch;
+	};
+
+	RenderQueue gRenderQueue;
+
+	// World-space bounding boxes of the frame's candidate draws, laid out for the SIMD frustum test
+	struct CullBatch
+	{
+		std::vector<float> minX, minY, minZ;
+		std::vector<float> maxX, maxY, maxZ;
+		std::vector<glm::uint8> visible;
+	};
+
+	// Draws recorded by one thread as plain data, with no GL calls. The GL thread merges
+	// every list into the render queue and submits it
+	struct CommandList
+	{
+		std::vector<uint64_t> keys;
+		std::vector<DrawItem> items;
+		CullBatch cull;
+	};
+
+	// Called with a [begin, end) range of a parallel-for and the index of the thread running it
+	typedef std::function<void(size_t, size_t, unsigned)> JobBody;
+
+	// Fixed pool of worker threads running one parallel-for at a time. The calling thread
+	// takes chunks too, so a pool without workers runs everything inline
+	struct JobSystem
+	{
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		// Current job: chunks of grain items are claimed from next until count is reached
+		const JobBody* body;
+		size_t count;
+		size_t grain;
+		std::atomic<size_t> next;
+		// Workers still inside the current job
+		unsigned pending;
+		// Bumped for every job so sleeping workers can tell a new one arrived
+		uint64_t generation;
+		bool quit;
+	};
+
+	// Set by --threads: worker threads besides the GL thread, -1 for one per remaining core
+	int gWorkerCount = -1;
+	JobSystem gJobs;
+	// One list per thread of gJobs, indexed by the thread index the job receives
+	std::vector<CommandList> gCommandLists;
+	// Items per chunk when splitting submeshes and stress instances across threads
+	const size_t SUBMESH_JOB_GRAIN = 64;
+	const size_t INSTANCE_JOB_GRAIN = 4096;
+
+	// Binding point of the InstanceBlock shader storage block holding per-instance model matrices
+	const GLuint INSTANCE_BLOCK_BINDING = 1;
+
+	// Binding points of the buffers written by the culling compute shader
+	const GLuint VISIBLE_BLOCK_BINDING = 2;
+	const GLuint COMMAND_BLOCK_BINDING = 3;
+	// Work group size of the culling compute shader
+	const GLuint CULL_GROUP_SIZE = 64;
+
+	// Copies of one submesh drawn with a single instanced call, each with its own model matrix.
+	// The instance index of each copy comes from visibleBuffer through a per-instance attribute,
+	// so the culling pass can compact survivors there and the draw reads only those.
+	// Model matrices and the indirect command live in the stream buffer, rewritten every frame
+	struct GLInstances
+	{
+		GLuint visibleBuffer;
+		GLuint vao;
+		GLsizei count;
+		const GLSubmesh* submesh;
+	};
+
+	// Uniform handles of the culling compute program
+	struct CullUniforms
+	{
+		GLint frustumPlanes, boundingSphere, instanceCount;
+	};
+
+	// Set by --stress: number of Rubik's cubes spread over the tabletop, 0 when off
+	GLsizei gStressCount = 0;
+	const GLsizei DEFAULT_STRESS_COUNT = 100000;
+	GLInstances gInstances;
+	GLProgram gInstanceProgram;
+	GLint gInstanceTextureLoc;
+
+	// Transforms of the stress instances as structure-of-arrays, one array per component,
+	// composed into the instance buffer every frame. Each cube spins about the table's normal
+	struct InstanceTransforms
+	{
+		std::vector<float> position[3];
+		std::vector<float> rotation[4];
+		std::vector<float> scale[3];
+		// Grid cell center and starting rotation (about z only) of each instance
+		std::vector<float> cellX, cellY;
+		std::vector<float> startZ, startW;
+		// Object-space center of the submesh's bottom face, kept on the cell center while spinning
+		glm::vec3 pivot;
+		// Composition time since the last report, printed every STATE_REPORT_INTERVAL seconds
+		double reportSeconds;
+		unsigned reportFrames;
+		double lastReportTime;
+	};
+
+	InstanceTransforms gInstanceTransforms;
+	// Radians per second
+	const float INSTANCE_SPIN_SPEED = 1.0f;
+
+	// Cleared by --no-cull: draw every instance instead of culling them on the GPU first
+	bool gGpuCulling = true;
+	GLProgram gCullProgram;
+	CullUniforms gCullUniforms;
+
+	// Set by --batched: draw the scene through gBatch instead of one draw per submesh
+	bool gBatchedPath = false;
+	GLBatch gBatch;
+	GLProgram gBatchProgram;
+
+	// Parent index of root nodes
+	const uint32_t NO_PARENT = 0xFFFFFFFF;
+
+	// Scene transforms, one entry per node in each array. Nodes are stored breadth-first: parents come
+	// before their children and siblings are contiguous, so a subtree can be walked through
+	// firstChild/childCount and updating in index order always finds the parent's world matrix current.
+	// A dirty node's whole subtree is dirty too, so an update only has to visit what moved
+	struct TransformHierarchy
+	{
+		std::vector<uint32_t> parent;
+		std::vector<uint32_t> firstChild;
+		std::vector<uint32_t> childCount;
+		std::vector<glm::vec3> position;
+		std::vector<glm::quat> rotation;
+		std::vector<glm::vec3> scale;
+		std::vector<glm::mat4> world;
+		std::vector<unsigned char> dirty;
+		// Nodes whose world matrix is stale
+		std::vector<uint32_t> dirtyList;
+	};
+
+	TransformHierarchy gTransforms;
+	// The table carries the book and the cube, so moving it moves them along
+	uint32_t gTableNode, gBookNode, gCubeNode;
+	// Cube turn the hierarchy currently holds. Render thread only
+	float gAppliedCubeTurn = 0.0f;
+
+#ifdef _DEBUG
+	// Range overlap check: how many times each vertex was submitted this frame,
+	// and a query counting the triangles the draws generated. Neither sees fragments, so depth
+	// overdraw between objects that overlap on screen goes unnoticed
+	std::vector<unsigned char> gVertexDrawCounts;
+	GLuint gPrimitivesQuery = 0;
+#endif
 
 	// global cam variables
 	glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 1.0f);
 	glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, 1.0f);
 	glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 
-	// deltaTime ensures all users have similar movement speed
+	// deltaTime ensures all users have similar movement speed: every simulation tick advances by exactly this much
 	float deltaTime = 0.0f;
-	float lastFrame = 0.0f;
+	// glfwGetTime() when the main loop last measured elapsed time
+	double lastFrame = 0.0;
+
+	// Simulation ticks per second. Input is sampled and camera/light state advanced once per tick,
+	// whatever the frame rate, and the render thread interpolates between the last two ticks
+	const double SIM_TICK_RATE = 60.0;
+	// Longest stretch of real time simulated in one go, so a long stall doesn't trigger a burst of catch-up ticks
+	const double MAX_SIM_CATCH_UP = 0.25;
+	// Camera and light speeds in units per second, matching the old per-frame steps at 60 frames per second
+	const float CAMERA_SPEED = 2.5f * 60.0f;
+	const float LIGHT_SPEED = 0.01f * 60.0f;
 
 	// initial mouse coords
 	float lastX = 400, lastY = 300;
@@ -88,8 +559,110 @@ namespace
 	// bool to change perspective to ortho
 	bool perspective = true;
 
-	// Checking to see if projection was changed on last frame
-	bool lastFrameCheck = false;
+	// Turn of the Rubik's cube about its own vertical axis, in degrees, stepped by the turn-cube action
+	float cubeTurn = 0.0f;
+	const float CUBE_TURN_STEP = 90.0f;
+
+	// What the keyboard can do. Each key maps to at most one action; an action can have several keys
+	enum InputAction
+	{
+		ACTION_NONE = -1,
+		ACTION_QUIT,
+		ACTION_FORWARD,
+		ACTION_BACK,
+		ACTION_RIGHT,
+		ACTION_LEFT,
+		ACTION_DOWN,
+		ACTION_UP,
+		ACTION_LIGHT_LEFT,
+		ACTION_LIGHT_RIGHT,
+		ACTION_LIGHT_UP,
+		ACTION_LIGHT_DOWN,
+		ACTION_LIGHT_NEAR,
+		ACTION_LIGHT_FAR,
+		ACTION_TOGGLE_PROJECTION,
+		ACTION_TURN_CUBE,
+		ACTION_COUNT
+	};
+
+	// Names --bind accepts, in InputAction order
+	const char* const ACTION_NAMES[ACTION_COUNT] = { "quit", "forward", "back", "right", "left", "down", "up",
+		"light-left", "light-right", "light-up", "light-down", "light-near", "light-far", "projection", "turn-cube" };
+
+	struct KeyBinding
+	{
+		int key;
+		InputAction action;
+	};
+
+	const KeyBinding DEFAULT_BINDINGS[] =
+	{
+		{ GLFW_KEY_ESCAPE, ACTION_QUIT },
+		{ GLFW_KEY_W, ACTION_FORWARD },
+		{ GLFW_KEY_S, ACTION_BACK },
+		{ GLFW_KEY_D, ACTION_RIGHT },
+		{ GLFW_KEY_A, ACTION_LEFT },
+		{ GLFW_KEY_Q, ACTION_DOWN },
+		{ GLFW_KEY_E, ACTION_UP },
+		{ GLFW_KEY_LEFT, ACTION_LIGHT_LEFT },
+		{ GLFW_KEY_RIGHT, ACTION_LIGHT_RIGHT },
+		{ GLFW_KEY_UP, ACTION_LIGHT_UP },
+		{ GLFW_KEY_DOWN, ACTION_LIGHT_DOWN },
+		{ GLFW_KEY_RIGHT_SHIFT, ACTION_LIGHT_NEAR },
+		{ GLFW_KEY_RIGHT_CONTROL, ACTION_LIGHT_FAR },
+		{ GLFW_KEY_P, ACTION_TOGGLE_PROJECTION },
+		{ GLFW_KEY_R, ACTION_TURN_CUBE }
+	};
+
+	// Key names --bind accepts besides single letters, digits and key codes
+	struct KeyName
+	{
+		const char* name;
+		int key;
+	};
+	const KeyName KEY_NAMES[] =
+	{
+		{ "SPACE", GLFW_KEY_SPACE }, { "ESCAPE", GLFW_KEY_ESCAPE }, { "ENTER", GLFW_KEY_ENTER }, { "TAB", GLFW_KEY_TAB },
+		{ "LEFT", GLFW_KEY_LEFT }, { "RIGHT", GLFW_KEY_RIGHT }, { "UP", GLFW_KEY_UP }, { "DOWN", GLFW_KEY_DOWN },
+		{ "PAGE_UP", GLFW_KEY_PAGE_UP }, { "PAGE_DOWN", GLFW_KEY_PAGE_DOWN }, { "HOME", GLFW_KEY_HOME }, { "END", GLFW_KEY_END },
+		{ "LEFT_SHIFT", GLFW_KEY_LEFT_SHIFT }, { "RIGHT_SHIFT", GLFW_KEY_RIGHT_SHIFT },
+		{ "LEFT_CONTROL", GLFW_KEY_LEFT_CONTROL }, { "RIGHT_CONTROL", GLFW_KEY_RIGHT_CONTROL },
+		{ "LEFT_ALT", GLFW_KEY_LEFT_ALT }, { "RIGHT_ALT", GLFW_KEY_RIGHT_ALT }
+	};
+
+	enum InputEventType
+	{
+		INPUT_KEY,
+		INPUT_CURSOR,
+		INPUT_SCROLL
+	};
+
+	// One GLFW callback, stamped with glfwGetTime() when it arrived
+	struct InputEvent
+	{
+		InputEventType type;
+		double time;
+		// INPUT_KEY
+		int key;
+		bool pressed;
+		// INPUT_CURSOR position, INPUT_SCROLL offset
+		double x, y;
+	};
+
+	// Input is event-driven: the GLFW callbacks only queue events, and UProcessInput applies them once per
+	// simulation tick. Held keys are a bitset and the actions they drive are counted as keys go up and down,
+	// so a tick costs the same however many keys are bound
+	struct InputState
+	{
+		std::bitset<GLFW_KEY_LAST + 1> keys;
+		InputAction keyActions[GLFW_KEY_LAST + 1];
+		// Number of keys down that are bound to each action
+		unsigned char actionKeys[ACTION_COUNT];
+		std::vector<InputEvent> events;
+		// Arrival time of the oldest event the last tick applied, 0 when it had none
+		double tickEventTime;
+	};
+	InputState gInput;
 
 	// light color
 	glm::vec3 gLightColor(1.0f, 1.0f, 1.0f);
@@ -98,35 +671,697 @@ namespace
 	float lX = 0.1f, lY = 0.04f, lZ = 3.5f; // Allows light source variables to be changed
 	glm::vec3 gLightPosition(lX, lY, lZ);
 	glm::vec3 gLightScale(0.3f);
+
+	// Everything the render thread needs from the input side to draw a frame
+	struct CameraSnapshot
+	{
+		glm::vec3 position;
+		glm::vec3 front;
+		glm::vec3 up;
+		glm::vec3 light;
+		bool perspective;
+		float cubeTurn;
+		// glfwGetTime() when the main thread sampled the input
+		double sampleTime;
+		// glfwGetTime() when the oldest input event behind this state arrived, 0 if none did
+		double inputTime;
+		// Simulation time of the tick that produced the state, on the glfwGetTime() clock
+		double simTime;
+	};
+
+	enum RenderMessageType
+	{
+		MESSAGE_CAMERA,
+		MESSAGE_RESIZE
+	};
+
+	// One entry of the queue from the main thread to the render thread
+	struct RenderMessage
+	{
+		RenderMessageType type;
+		// MESSAGE_CAMERA
+		CameraSnapshot camera;
+		// MESSAGE_RESIZE, in framebuffer pixels
+		int width, height;
+	};
+
+	// Lock-free single-producer/single-consumer ring: only the main thread pushes and only the
+	// render thread pops. Each side owns one of the free-running indices
+	const uint32_t MESSAGE_QUEUE_SIZE = 256;
+	struct MessageQueue
+	{
+		RenderMessage slots[MESSAGE_QUEUE_SIZE];
+		std::atomic<uint32_t> head;
+		std::atomic<uint32_t> tail;
+	};
+
+	MessageQueue gMessages;
+
+	// The render thread owns the GL context while the main thread handles GLFW events and input
+	std::thread gRenderThread;
+	std::atomic<bool> gRenderQuit;
+	// Frames finished by the render thread since the last rate report, and since it started
+	std::atomic<unsigned> gRenderFrames;
+	std::atomic<unsigned> gRenderFrameCount;
+	// Last two simulation ticks the render thread has received, and the state it draws, interpolated
+	// between them. Only the render thread touches these
+	CameraSnapshot gPreviousCamera;
+	CameraSnapshot gCurrentCamera;
+	CameraSnapshot gRenderCamera;
+	// A resize the render thread has not been told about yet, kept until the queue has room
+	bool gResizePending = false;
+	int gResizeWidth = 0, gResizeHeight = 0;
+
+	// Set by --latency and --late-latch
+	bool gLatencyStats = false;
+	bool gLateLatch = false;
+
+	// Frames whose fence is polled at most; a GPU further behind than this drops samples instead
+	const int LATENCY_MAX_PENDING = 8;
+
+	// A presented frame that showed new input, waiting for the GPU to finish it
+	struct LatencyFrame
+	{
+		double inputTime;
+		GLsync fence;
+	};
+
+	// Motion-to-photon measurement on the render thread. Input time is when the GLFW callback ran; a frame
+	// counts it once, the first time it draws with it. The fence is polled at the start of later frames,
+	// so completion times are late by up to one frame
+	struct LatencyTracker
+	{
+		LatencyFrame pending[LATENCY_MAX_PENDING];
+		int pendingCount;
+		// Samples since the last report, printed every STATE_REPORT_INTERVAL seconds
+		std::vector<double> toSwap;
+		std::vector<double> toComplete;
+		unsigned dropped;
+		double lastReportTime;
+	};
+	LatencyTracker gLatency;
+	// Input time of the frame being drawn, 0 when it shows nothing new. Render thread only
+	double gRenderInputTime = 0.0;
+
+	// Newest mouse look, published by the main thread on every cursor event when late latching.
+	// Yaw and pitch share one word so the render thread always reads a matching pair
+	std::atomic<uint64_t> gLatchedLook;
+	std::atomic<double> gLatchedLookTime;
+	// Last latched look the render thread used, so unchanged looks don't count as new input
+	double gLastLatchedTime = 0.0;
+
+	// Set by --idle
+	bool gIdleRendering = false;
+	// Longest either thread blocks while idle, so periodic reports and trace dump requests still get through
+	const double IDLE_WAIT_SECONDS = 0.5;
+
+	// Why a frame was drawn; a frame can have several reasons
+	enum RedrawReason
+	{
+		REDRAW_FIRST_FRAME,
+		REDRAW_CAMERA,
+		REDRAW_LIGHT,
+		REDRAW_PROJECTION,
+		REDRAW_RESIZE,
+		REDRAW_ANIMATION,
+		REDRAW_TRANSFORMS,
+		REDRAW_LATE_LATCH,
+		REDRAW_REASON_COUNT
+	};
+	const char* const REDRAW_REASON_NAMES[REDRAW_REASON_COUNT] = { "first frame", "camera", "light", "projection",
+		"resize", "animation", "transforms", "late latch" };
+
+	// Damage tracking for --idle. The render thread compares what it would draw with what it drew last and
+	// sleeps on wake when nothing differs; the main thread signals wake whenever it sends a message
+	struct DamageTracker
+	{
+		CameraSnapshot drawn;
+		bool firstFrame;
+		bool resized;
+		// Totals since the last report, printed every STATE_REPORT_INTERVAL seconds
+		unsigned reasonCounts[REDRAW_REASON_COUNT];
+		unsigned redraws;
+		double idleSeconds;
+		double lastReportTime;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool wakePending;
+	};
+	DamageTracker gDamage;
+
+	// Set by --vsync. SWAP_DEFAULT means on, except for the benchmark, which runs uncapped
+	enum SwapMode { SWAP_DEFAULT, SWAP_OFF, SWAP_ON, SWAP_ADAPTIVE };
+	const char* const SWAP_MODE_NAMES[] = { "default", "off", "on", "adaptive" };
+	SwapMode gSwapMode = SWAP_DEFAULT;
+	// Set by --fps, 0 for no limit
+	double gTargetFps = 0.0;
+
+	// Frame times are counted in FRAME_HISTOGRAM_BUCKETS buckets of FRAME_HISTOGRAM_BUCKET seconds, the last one open-ended
+	const int FRAME_HISTOGRAM_BUCKETS = 100;
+	const double FRAME_HISTOGRAM_BUCKET = 0.0005;
+	// Buckets holding less than this share of the frames are left out of the report
+	const double FRAME_HISTOGRAM_MIN_SHARE = 0.01;
+	// Bounds of the time the limiter spins before a deadline instead of sleeping
+	const double LIMITER_MIN_SPIN = 0.0002;
+	const double LIMITER_MAX_SPIN = 0.004;
+	// How fast the spin margin forgets an oversleep, per frame
+	const double LIMITER_SPIN_DECAY = 0.99;
+
+	// Frame pacing of the render thread. The limiter sleeps until spinMargin before each deadline, then spins.
+	// spinMargin tracks the worst recent oversleep, the error budget of the sleep: it jumps up to cover a late
+	// wake-up and decays slowly, so spinning stays as short as the scheduler allows
+	struct FramePacer
+	{
+		double interval;
+		double deadline;
+		double spinMargin;
+		double lastFrameTime;
+		// Totals since the last report, printed every STATE_REPORT_INTERVAL seconds
+		unsigned histogram[FRAME_HISTOGRAM_BUCKETS];
+		unsigned frames;
+		double total;
+		double totalSquares;
+		double slowest;
+		double limiterError;
+		unsigned limitedFrames;
+		double lastReportTime;
+	};
+	FramePacer gPacer;
+
+	// Set by --headless: frames to render offscreen before exiting, 0 for the interactive window
+	int gHeadlessFrames = 0;
+	const int DEFAULT_HEADLESS_FRAMES = 300;
+
+	// Set by --tick-test: seconds to run the threaded loop before checking its tick rate, 0 for no test
+	double gTickTestSeconds = 0.0;
+	const double DEFAULT_TICK_TEST_SECONDS = 3.0;
+	// Frame delay the tick test uses unless --render-delay gives one: 20 frames/s, a third of the tick rate
+	const int TICK_TEST_RENDER_DELAY_MS = 50;
+	// Largest relative difference from SIM_TICK_RATE the tick test accepts
+	const double TICK_TEST_TOLERANCE = 0.02;
+	// Set by --render-delay: milliseconds the render thread sleeps after drawing each frame
+	int gRenderDelayMs = 0;
+	// Set by --dump: file name prefix for the frames rendered headless, nullptr to keep them in memory
+	const char* gDumpPrefix = nullptr;
+
+	// Color and depth renderbuffers the headless mode draws into instead of the window
+	struct GLOffscreenTarget
+	{
+		GLuint fbo;
+		GLuint color;
+		GLuint depth;
+		GLsizei width, height;
+	};
+
+	GLOffscreenTarget gOffscreen;
+
+	// One point of a camera path: the camera and light at some time after the path starts.
+	// Path files hold one key per line as "time x y z yaw pitch lightX lightY lightZ"; lines starting with # are comments
+	struct CameraKey
+	{
+		double time;
+		glm::vec3 position;
+		float yaw, pitch;
+		glm::vec3 light;
+	};
+
+	// Set by --benchmark: frames to draw along a camera path, 0 when off
+	int gBenchmarkFrames = 0;
+	const int DEFAULT_BENCHMARK_FRAMES = 1000;
+	// Frames drawn before measuring starts, so first-use costs like shader compilation stay out of the numbers
+	const int BENCHMARK_WARMUP_FRAMES = 30;
+	// Set by --path: camera path file the benchmark follows, nullptr for the built-in orbit
+	const char* gPathFile = nullptr;
+	// Set by --report: file the benchmark's JSON goes to, nullptr for the console
+	const char* gReportFile = nullptr;
+	// Set by --record: file every simulation tick of an interactive session is appended to as a camera key
+	const char* gRecordFile = nullptr;
+
+	// Draw calls issued by the current frame, counted at every draw site
+	unsigned gFrameDrawCalls = 0;
+
+	// Scopes one frame can time, frames of queries in flight before a frame is read back,
+	// and frames each scope's rolling statistics cover
+	const unsigned GPU_SCOPES_PER_FRAME = 32;
+	const unsigned GPU_QUERY_FRAMES = 4;
+	const unsigned GPU_STATS_WINDOW = 120;
+
+	// Timestamp queries of one frame: scope i writes queries 2i at its start and 2i + 1 at its end
+	struct GpuQueryFrame
+	{
+		GLuint queries[2 * GPU_SCOPES_PER_FRAME];
+		const char* names[GPU_SCOPES_PER_FRAME];
+		unsigned scopeCount;
+	};
+
+	// GPU milliseconds of one named scope over the last GPU_STATS_WINDOW frames it ran in
+	struct GpuScopeStats
+	{
+		const char* name;
+		double samples[GPU_STATS_WINDOW];
+		unsigned sampleCount;
+		unsigned next;
+	};
+
+	// GL_TIMESTAMP pairs around the passes of a frame. Each frame uses one set of a ring of
+	// GPU_QUERY_FRAMES and reads the set back when it comes round again, by which point the GPU
+	// has long finished it; a set still not ready then is dropped rather than waited for
+	struct GpuProfiler
+	{
+		bool enabled;
+		GpuQueryFrame frames[GPU_QUERY_FRAMES];
+		// Frames begun so far; the current set is frames[frame % GPU_QUERY_FRAMES]
+		unsigned frame;
+		std::vector<GpuScopeStats> stats;
+		// GL_TIMESTAMP and UNowNanoseconds() read together, placing GPU times on the CPU clock in traces
+		GLint64 gpuEpoch;
+		uint64_t cpuEpoch;
+		// Frames dropped since the last report, printed every STATE_REPORT_INTERVAL seconds
+		unsigned reportDropped;
+		double lastReportTime;
+	};
+
+	// Set by --gpu-timers
+	bool gGpuTimers = false;
+	GpuProfiler gGpuProfiler;
+	// Returned by UGpuScopeBegin when nothing is timed, so the matching UGpuScopeEnd does nothing
+	const unsigned NO_GPU_SCOPE = GPU_SCOPES_PER_FRAME;
+
+	// One complete event of a Chrome trace, in nanoseconds on the UNowNanoseconds() clock,
+	// or in UTraceTicks() units while it sits in a thread's ring
+	struct TraceEvent
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t duration;
+		uint32_t thread;
+	};
+
+	// Set by --trace: file the trace is written to on exit, nullptr to keep no trace
+	const char* gTraceFile = nullptr;
+	// Track the GPU scopes are shown on, apart from the CPU threads
+	const uint32_t TRACE_GPU_THREAD = 0;
+	// Events kept at most, so a long session can't grow the trace without bound
+	const size_t TRACE_MAX_EVENTS = 1 << 20;
+	std::vector<TraceEvent> gGpuTraceEvents;
+
+	// Zones each thread keeps, oldest overwritten first. Must be a power of two
+	const uint64_t TRACE_RING_SIZE = 1 << 16;
+
+	// Zones closed on one thread. Only the owning thread writes, publishing each event through head;
+	// a dump reads from any thread and discards whatever the owner may have overwritten meanwhile
+	struct TraceRing
+	{
+		TraceEvent events[TRACE_RING_SIZE];
+		std::atomic<uint64_t> head;
+		uint32_t thread;
+		const char* threadName;
+	};
+
+	// Every thread's ring, registered on the thread's first zone and kept until exit so a dump can
+	// still read threads that have finished
+	std::mutex gTraceMutex;
+	std::vector<std::unique_ptr<TraceRing>> gTraceRings;
+	thread_local TraceRing* gThreadTraceRing = nullptr;
+	// UTraceTicks() and UNowNanoseconds() read together at startup, converting zones to nanoseconds
+	uint64_t gTraceEpochTicks = 0;
+	uint64_t gTraceEpochNs = 0;
+	// Set from the signal handler; the next frame writes the trace
+	std::atomic<bool> gTraceDumpRequested(false);
+	// Trace file for a dump requested without --trace
+	const char* const DEFAULT_TRACE_FILE = "trace.json";
+
+	// Message severities, least severe first
+	enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR };
+	const char* const LOG_LEVEL_NAMES[] = { "debug", "info", "warning", "error" };
+
+	// One formatted message on its way to the writer thread
+	struct LogMessage
+	{
+		std::atomic<LogMessage*> next;
+		LogLevel level;
+		std::string text;
+	};
+
+	// Lock-free multi-producer/single-consumer queue of messages (an intrusive list with a stub node):
+	// any thread pushes with one atomic exchange, and only the writer thread pops. The writer wakes
+	// every LOG_WRITE_INTERVAL_MS and writes everything queued with a single flush, so logging never
+	// waits on the console or the disk
+	struct Logger
+	{
+		std::atomic<LogMessage*> head;
+		LogMessage* tail;
+		LogMessage stub;
+		std::thread writer;
+		std::atomic<bool> running;
+		std::atomic<bool> quit;
+		std::ofstream file;
+	};
+
+	// Set by --log-level and --log
+	LogLevel gLogLevel = LOG_INFO;
+	const char* gLogFile = nullptr;
+	Logger gLog;
+	const int LOG_WRITE_INTERVAL_MS = 10;
 }
 
 // Initializes libraries and window/context
 bool UInitialize(int, char* [], GLFWwindow** window);
 // Resizes active window if user or program changes size
 void UResizeWindow(GLFWwindow* window, int width, int height);
-// Processes input (like a keyboard key) and does something with it
+// Applies the input events queued since the last tick, then moves the camera and light for the keys held
 void UProcessInput(GLFWwindow* window);
-// Mouse scroll callback
+// Mouse scroll callback, queues the event
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
+// Key callback, queues the event
+void UKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+// Clears the action map and binds the default keys
+void UInputBindDefaults(InputState& input);
+// Parses <action>=<key> and binds the key to the action
+bool UInputBind(InputState& input, const char* binding);
+// GLFW key code for a letter, digit, key name or number; GLFW_KEY_UNKNOWN if it is none of those
+int UParseKey(const char* name);
+// Handles a key going down or up
+void UApplyKeyEvent(GLFWwindow* window, InputState& input, const InputEvent& event);
+// Turns the camera for a new cursor position
+void UApplyCursor(double xpos, double ypos);
 // Setting index locations, colors, etc...
 void UCreateMesh(GLMesh& mesh);
+// Builds a draw range with its object-space bounds, read from the interleaved vertices
+GLSubmesh UMakeSubmesh(const char* name, GLint first, GLsizei count, GLint textureUnit, const GLfloat* verts, GLuint floatsPerVertex);
 // Destroys locations
 void UDestroyMesh(GLMesh& mesh);
-// Actually renders the pyramid and allows for transformations
+// Builds a sort key: state fields first, then view depth (front-to-back for opaque, back-to-front otherwise)
+uint64_t URenderKey(RenderPass pass, GLuint program, GLuint texture, GLuint vao, float depth, float farPlane);
+// Empties the queue, keeping its storage for the next frame
+void URenderQueueClear(RenderQueue& queue);
+// Adds one draw to the queue
+void URenderQueuePush(RenderQueue& queue, uint64_t key, const DrawItem& item);
+// LSD radix sort of the queue's keys, 8 bits per pass, skipping passes where every key shares the digit
+void URenderQueueSort(RenderQueue& queue);
+// Submits the queue in key order, only changing state and uniforms between draws when they differ
+void URenderQueueSubmit(const RenderQueue& queue);
+#ifdef _DEBUG
+// Marks a vertex range as submitted for the range overlap check
+void UCountDrawnVertices(GLint first, GLsizei count);
+#endif
+// Builds the indirect commands, per-draw layer buffer, VAO and texture array for the batched path
+bool UCreateBatch(const GLMesh& mesh, GLBatch& batch);
+// Releases everything UCreateBatch created
+void UDestroyBatch(GLBatch& batch);
+// Submits every submesh of the mesh with one glMultiDrawArraysIndirect call
+void UDrawBatch(const GLMesh& mesh, const GLBatch& batch);
+// Finds a submesh by name, nullptr if the mesh has none
+const GLSubmesh* UFindSubmesh(const GLMesh& mesh, const char* name);
+// Places count copies of a submesh on a grid covering the tabletop and uploads their matrices
+void UCreateStressInstances(const GLMesh& mesh, const GLSubmesh& submesh, GLsizei count, GLInstances& instances, InstanceTransforms& transforms);
+// Spins every instance to its pose at the given time, composes the new matrices into the stream buffer and binds them
+void UAnimateInstances(InstanceTransforms& transforms, const GLInstances& instances, double time);
+// Spins instances [begin, end) and composes their matrices into models, which holds every instance's matrix
+void UAnimateInstanceRange(InstanceTransforms& transforms, size_t begin, size_t end, float spinZ, float spinW, float* models);
+// Starts workerCount worker threads
+void UJobsStart(JobSystem& jobs, unsigned workerCount);
+// Wakes and joins every worker
+void UJobsStop(JobSystem& jobs);
+// Runs body over [0, count) in chunks of grain items on the workers and the calling thread, returning when all are done
+void UJobsParallelFor(JobSystem& jobs, size_t count, size_t grain, const JobBody& body);
+// Worker thread loop: sleeps until a job arrives, then takes chunks until none are left
+void UJobsWorker(JobSystem* jobs, unsigned index);
+// Claims and runs chunks of the current job until it is exhausted
+void UJobsRunChunks(JobSystem& jobs, unsigned index);
+// Culls submeshes [begin, end) and records a draw and sort key for each visible one. Makes no GL calls
+void URecordSubmeshes(CommandList& list, const GLMesh& mesh, size_t begin, size_t end, const glm::mat4& view, const glm::mat4& viewProjection);
+// Deletes the instance buffers
+void UDestroyInstances(GLInstances& instances);
+// Draws the instances: the culled survivors through the indirect command at commandOffset in the stream buffer, or all of them
+void UDrawInstances(const GLInstances& instances, GLintptr commandOffset);
+// Dispatches the culling compute shader, which fills the visible list and an indirect command in the stream buffer.
+// Returns the command's offset, or -1 if the stream buffer had no room
+GLintptr UCullInstances(const GLInstances& instances, const glm::mat4& viewProjection);
+// Transforms a box by a matrix and returns the axis-aligned box around the result
+void UTransformBounds(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec3& outMin, glm::vec3& outMax);
+// Empties the cull batch and reserves room for count boxes
+void UCullBatchClear(CullBatch& batch, size_t count);
+// Appends a world-space box to the cull batch
+void UCullBatchPush(CullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+// Tests every box in the batch against the frustum of viewProjection, filling batch.visible
+void UCullBatchTest(CullBatch& batch, const glm::mat4& viewProjection);
+// Appends a node under parent (NO_PARENT for a root) and returns its index. Nodes must be added breadth-first
+uint32_t UTransformAddNode(TransformHierarchy& hierarchy, uint32_t parent, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+// Replaces a node's local transform and marks its subtree dirty
+void UTransformSetLocal(TransformHierarchy& hierarchy, uint32_t node, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+// Marks a node and everything below it as needing a new world matrix
+void UTransformMarkDirty(TransformHierarchy& hierarchy, uint32_t node);
+// Recomputes the world matrices of dirty nodes only and returns how many were updated
+size_t UTransformUpdate(TransformHierarchy& hierarchy);
+// Builds the transform nodes of the scene and assigns one to each submesh
+void UCreateScene(GLMesh& mesh, TransformHierarchy& hierarchy);
+// Sets the cube node's local transform to a turn about the cube's own center
+void UTurnCube(const GLMesh& mesh, TransformHierarchy& hierarchy, float degrees);
+// Copies the world matrix of each submesh to the batch's model buffer, staged through the stream buffer
+void UUpdateBatchModels(const GLMesh& mesh, const TransformHierarchy& hierarchy, const GLBatch& batch);
+// Points attributes 0-2 of the bound VAO at the mesh's position/normal/UV data
+void USetMeshAttributes(const GLMesh& mesh);
+// Creates, compiles and links a compute-only program
+bool UCreateComputeProgram(const char* computeShaderSource, GLProgram& program);
+#ifdef _DEBUG
+// Resets the per-frame range overlap counters
+void UBeginRangeOverlapCheck(const GLMesh& mesh);
+// Reports any vertex submitted more than once this frame, or a triangle count that differs from what was submitted
+void UEndRangeOverlapCheck();
+#endif
+// Actually renders the pyramid and allows for transformations. Presenting is up to the caller
 void URender();
 // Creates, compiles, and deleted shader programs (when error occurs)
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program);
+// Cache key of a program: FNV-1a over its sources and the driver's vendor, renderer and version strings
+uint64_t UProgramCacheKey(const char* const sources[], int sourceCount);
+// Creates the program from a cached binary, false when there is none or the driver rejects it
+bool ULoadProgramBinary(uint64_t key, GLProgram& program);
+// Writes a linked program's binary to the cache. The program must have been linked retrievable
+void USaveProgramBinary(uint64_t key, GLuint programId);
 // Deleting shader programs
-void UDestroyShaderProgram(GLuint programId);
-// Captures mouse events commented out for now
+void UDestroyShaderProgram(GLProgram& program);
+// Fills the program's uniform table from the driver's list of active uniforms
+void UReflectUniforms(GLProgram& program);
+// Looks up a reflected uniform by name, checking it has the expected GL type
+GLint UGetUniform(const GLProgram& program, const char* name, GLenum type);
+// Checks a reflected uniform block sits on the expected binding with the expected size
+bool UCheckUniformBlock(const GLProgram& program, const char* name, GLuint binding, GLint dataSize);
+// Creates and maps a stream buffer of STREAM_FRAME_COUNT regions holding at least regionSize bytes each
+bool UCreateStreamBuffer(StreamBuffer& stream, GLsizeiptr regionSize);
+// Unmaps and deletes the stream buffer and any fence still pending
+void UDestroyStreamBuffer(StreamBuffer& stream);
+// Waits until the GPU is done with the frame that last used the current region
+void UStreamBeginFrame(StreamBuffer& stream);
+// Fences the current region behind the frame's commands and moves on to the next one
+void UStreamEndFrame(StreamBuffer& stream);
+// Hands out size bytes of the current region, aligned for use as a uniform or storage block range.
+// Returns where to write them and sets offset to their position in the buffer; nullptr if the region is full
+void* UStreamAllocate(StreamBuffer& stream, GLsizeiptr size, GLintptr& offset);
+// Cursor callback, queues the event
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 // Loads texture for placing
 bool UCreateTexture(const char* filename, GLuint& textureId);
 // Deallocates memory from texture
 void UDestroyTexture(GLuint textureId);
+// Loads images into the layers of a square GL_TEXTURE_2D_ARRAY, resampling any that differ in size
+bool UCreateTextureArray(const char* const filenames[], GLsizei layerCount, GLsizei layerSize, GLuint& textureId);
+// Box-filters an image to a new size, used to bring textures to a common layer size
+void UResampleImage(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight, int channels);
+// Forgets everything the state cache knows, so the next call of each kind reaches GL
+void UStateReset(GLStateCache& state);
+// Cached glUseProgram
+void UStateUseProgram(GLStateCache& state, GLuint program);
+// Cached glBindVertexArray
+void UStateBindVertexArray(GLStateCache& state, GLuint vao);
+// Cached glActiveTexture + glBindTexture on the given unit
+void UStateBindTexture(GLStateCache& state, GLuint unit, GLenum target, GLuint texture);
+// Slot of a buffer target in GLStateCache::buffers
+int UStateBufferIndex(GLenum target);
+// Cached glBindBuffer for the generic binding of a target
+void UStateBindBuffer(GLStateCache& state, GLenum target, GLuint buffer);
+// glBindBufferBase, which also replaces the generic binding of the target
+void UStateBindBufferBase(GLStateCache& state, GLenum target, GLuint index, GLuint buffer);
+// glBindBufferRange, which also replaces the generic binding of the target
+void UStateBindBufferRange(GLStateCache& state, GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+// Cached glEnable / glDisable
+void UStateSetEnabled(GLStateCache& state, GLenum capability, bool enabled);
+// Cached glClearColor
+void UStateClearColor(GLStateCache& state, GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+// Rolls the frame's issued/elided counts into the running report
+void UStateEndFrame(GLStateCache& state);
+// Adds a message for the render thread, false if the queue is full. Main thread only
+bool UMessagePush(MessageQueue& queue, const RenderMessage& message);
+// Takes the oldest message, false if there is none. Render thread only
+bool UMessagePop(MessageQueue& queue, RenderMessage& message);
+// Copies the camera and light state the input handlers maintain
+CameraSnapshot UCaptureCamera();
+// Blends two simulation ticks; alpha 0 gives from, 1 gives to
+CameraSnapshot UInterpolateCamera(const CameraSnapshot& from, const CameraSnapshot& to, float alpha);
+// Releases the context on this thread and starts the render thread with it
+void URenderThreadStart();
+// Stops the render thread and makes the context current on this thread again
+void URenderThreadStop();
+// Render thread loop: applies queued messages, then draws and presents a frame
+void URenderThread();
+// Interactive loop: samples input on this thread at the simulation rate while the render thread draws.
+// Runs until the window closes, or for duration seconds when that is positive; returns the ticks simulated
+unsigned URunWindowed(double duration);
+// Runs the loop for gTickTestSeconds with slow frames, false unless the tick rate still matched SIM_TICK_RATE
+bool URunTickTest();
+// Draws gHeadlessFrames frames into an offscreen target on this thread, optionally writing each to disk
+bool URunHeadless();
+// Creates a framebuffer with color and depth renderbuffers of the given size and binds it for drawing
+bool UCreateOffscreenTarget(GLOffscreenTarget& target, GLsizei width, GLsizei height);
+// Deletes the framebuffer and its renderbuffers, restoring the default framebuffer
+void UDestroyOffscreenTarget(GLOffscreenTarget& target);
+// Reads the bound framebuffer back and writes it as a binary PPM, top row first
+bool UWriteFramePPM(const char* filename, GLsizei width, GLsizei height, std::vector<unsigned char>& pixels);
+// Draws gBenchmarkFrames frames along a camera path on this thread and reports CPU, swap and draw call statistics
+bool URunBenchmark();
+// Reads a camera path file; keys must be in increasing time order
+bool ULoadCameraPath(const char* filename, std::vector<CameraKey>& path);
+// Fills the path with a loop orbiting above the table while the light sweeps across it
+void UDefaultCameraPath(std::vector<CameraKey>& path);
+// Catmull-Rom interpolation of the path at a time, looping once the path ends
+CameraKey USampleCameraPath(const std::vector<CameraKey>& path, double time);
+// Key holding the current camera and light globals
+CameraKey UCurrentCameraKey(double time);
+// Sets the camera and light globals to a key, as the input handlers would
+void UApplyCameraKey(const CameraKey& key);
+// Writes a key as one line of a path file
+void UWriteCameraKey(std::ostream& out, const CameraKey& key);
+// Points cameraFront along yaw and pitch
+void UUpdateCameraFront();
+// Publishes the look the next tick will reach once it applies every cursor event so far
+void UPublishLatchedLook(double xpos, double ypos, double time);
+// Rewrites the view matrix of the frame constants with the newest latched look, false if there is none yet
+bool ULateLatchView(FrameConstants& frame);
+// Fences a just presented frame that showed new input and records its input-to-swap time
+void ULatencyFrameDone(LatencyTracker& latency, double inputTime, double swapTime);
+// Records the frames the GPU has finished since the last call and reports the distributions periodically
+void ULatencyCollect(LatencyTracker& latency);
+// Deletes the fences still pending
+void ULatencyDestroy(LatencyTracker& latency);
+// True when no input event is waiting and no bound key is held, so a tick would change nothing
+bool UInputIdle(const InputState& input);
+// Bitmask of the RedrawReason values that differ between two camera states
+unsigned UCameraChanges(const CameraSnapshot& a, const CameraSnapshot& b);
+// Reasons the frame about to be drawn differs from the last one drawn, 0 if it would look the same
+unsigned UDamageCheck(DamageTracker& damage, float alpha);
+// Counts a drawn frame's reasons and remembers what it showed
+void UDamageRecord(DamageTracker& damage, unsigned reasons);
+// Blocks the render thread until the main thread sends something or IDLE_WAIT_SECONDS pass
+void UDamageWait(DamageTracker& damage);
+// Wakes the render thread from UDamageWait. Main thread
+void UDamageWake(DamageTracker& damage);
+// Logs the redraw counts every STATE_REPORT_INTERVAL seconds
+void UDamageReport(DamageTracker& damage);
+// Applies --vsync to the current context, falling back to on where adaptive sync is missing
+void USetSwapInterval(SwapMode mode);
+// Resets the statistics and sets the limiter to a frame rate, 0 for none
+void UPacerStart(FramePacer& pacer, double fps);
+// Holds the thread until the next frame deadline. Does nothing without a frame rate
+void UPacerWait(FramePacer& pacer);
+// Adds the time since the previous frame to the histogram and reports it periodically
+void UPacerRecordFrame(FramePacer& pacer);
+// Forgets the previous frame, so a deliberate pause doesn't show up as a slow frame
+void UPacerSkip(FramePacer& pacer);
+// Nearest-rank percentile of sorted values, p in [0, 100]
+double UPercentile(const std::vector<double>& sorted, double p);
+// Writes {"mean", "p50", "p95", "p99", "max"} of the values, in milliseconds, sorting them first
+void UWriteJsonStats(std::ostream& out, std::vector<double>& seconds);
+// Writes a string as a quoted JSON string
+void UWriteJsonString(std::ostream& out, const char* text);
+// Monotonic clock shared by every trace, in nanoseconds
+uint64_t UNowNanoseconds();
+// Creates the query sets and ties the GPU clock to the CPU one
+void UGpuProfilerCreate(GpuProfiler& profiler);
+// Reads back every set still in flight, waiting for the GPU, then deletes the queries
+void UGpuProfilerDestroy(GpuProfiler& profiler);
+// Reads back the set this frame is about to reuse and starts filling it; the scopes of a frame follow this call
+void UGpuProfilerBeginFrame(GpuProfiler& profiler);
+// Folds a finished set into the rolling statistics and the trace, false if the GPU has not reached its end yet
+bool UGpuProfilerCollect(GpuProfiler& profiler, GpuQueryFrame& frame, bool wait);
+// Writes a timestamp opening a named scope and returns its index, NO_GPU_SCOPE when timers are off or the frame is full
+unsigned UGpuScopeBegin(GpuProfiler& profiler, const char* name);
+// Writes the timestamp closing a scope from UGpuScopeBegin
+void UGpuScopeEnd(GpuProfiler& profiler, unsigned scope);
+// Writes the collected GPU scopes and every thread's CPU zones in the Chrome trace event format
+bool UWriteChromeTrace(const char* filename);
+// Reads the epoch the CPU zones are measured from and installs the dump signal handler
+void UTraceStart();
+// Raw zone clock: the time stamp counter where available, nanoseconds otherwise
+uint64_t UTraceTicks();
+// Appends a closed zone to the calling thread's ring
+void UTraceRecord(const char* name, uint64_t start, uint64_t end);
+// Creates the calling thread's ring if it has none and names its track in the trace
+TraceRing* UTraceRegisterThread(const char* name);
+// Asks for a trace dump; only sets a flag, so it is safe in a signal handler
+void UTraceSignalHandler(int signalNumber);
+// Writes the trace if a signal asked for one since the last check
+void UTraceCheckDumpRequest();
+// Starts the writer thread, sending messages to the file when one is given and to the console otherwise
+void ULogStart(const char* filename);
+// Writes whatever is still queued and joins the writer thread. Registered with atexit by ULogStart
+void ULogStop();
+// Queues a message for the writer, or writes it directly when the writer is not running
+void ULogPush(LogLevel level, const std::string& text);
+// Takes the oldest message, nullptr if none is ready. Writer thread only
+LogMessage* ULogPop(Logger& log);
+// Writer thread loop: batches queued messages into one write per wake-up
+void ULogWriter();
+// Appends a message as one output line, prefixed with its level unless it is LOG_INFO
+void ULogFormat(std::string& out, LogLevel level, const std::string& text);
 // Flipping image on Y axis
 void flipImageVertically(unsigned char* image, int width, int height, int channels);
 
+// Times the enclosing block into the calling thread's trace ring; declared through TRACE_ZONE
+struct TraceZone
+{
+	const char* name;
+	uint64_t start;
+
+	explicit TraceZone(const char* zoneName) : name(zoneName), start(UTraceTicks()) {}
+	~TraceZone() { UTraceRecord(name, start, UTraceTicks()); }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Records the rest of the enclosing scope as a zone named by the string literal
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+
+// Collects one message and queues it when it goes out of scope; used through LOG
+struct LogLine
+{
+	LogLevel level;
+	std::ostringstream stream;
+
+	explicit LogLine(LogLevel lineLevel) : level(lineLevel) {}
+	~LogLine() { ULogPush(level, stream.str()); }
+	std::ostream& out() { return stream; }
+};
+
+// Joins the job system's workers when it goes out of scope, so every early return from main stops them.
+// A std::thread still joinable at static teardown would call std::terminate
+struct JobsScope
+{
+	JobSystem& jobs;
+
+	explicit JobsScope(JobSystem& scopeJobs) : jobs(scopeJobs) {}
+	~JobsScope() { UJobsStop(jobs); }
+};
+
+// Lets LOG be a single expression, so it is safe as the body of an unbraced if/else
+struct LogVoidify
+{
+	void operator&(std::ostream&) {}
+};
+
+// Formats a message with << and hands it to the writer thread; messages below gLogLevel are never formatted
+#define LOG(level) ((level) < gLogLevel) ? (void)0 : LogVoidify() & LogLine(level).out()
+
 
 // Vertex Shader Source Code
 const GLchar* objectVertexShaderSource = GLSL(440,
@@ -138,10 +1373,29 @@ const GLchar* objectVertexShaderSource = GLSL(440,
 	out vec3 vertexFragmentPos;
 	out vec2 vertexTextureCoordinate;
 
+	struct Light {
+		vec3 position;
+		vec3 ambient;
+		vec3 diffuse;
+		vec3 specular;
+
+		float constant;
+		float linear;
+		float quadratic;
+	};
+
+	// Camera and light data written once per frame, shared by every program
+	layout(std140, binding = 0) uniform FrameBlock
+	{
+		mat4 view;
+		mat4 projection;
+		vec3 viewPosition;
+		vec3 lightPos;
+		Light light;
+	};
+
 	// variables to be used for transforming
 	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
 
 	void main()
 	{
@@ -176,11 +1430,17 @@ const GLchar* objectFragmentShaderSource = GLSL(440,
 
 	out vec4 fragmentColor; // For outgoing pyramid color to the GPU
 
-	// Uniform / Global variables for object color, light color, light position, and camera/view position
-	uniform vec3 lightPos;
-	uniform vec3 viewPosition;
+	// Light position, camera/view position and light properties, shared with every program
+	layout(std140, binding = 0) uniform FrameBlock
+	{
+		mat4 view;
+		mat4 projection;
+		vec3 viewPosition;
+		vec3 lightPos;
+		Light light;
+	};
+
 	uniform sampler2D uTexture; // Useful when working with multiple textures
-	uniform Light light;
 
 	layout(binding = 3) uniform sampler2D texSampler1;
 
@@ -217,61 +1477,476 @@ const GLchar* objectFragmentShaderSource = GLSL(440,
 	}
 );
 
-int main(int argc, char* argv[])
-{
-	if (!UInitialize(argc, argv, &gWindow))
-		return EXIT_FAILURE;
+// Vertex shader for the batched path: same as above, plus the per-draw texture layer
+const GLchar* batchVertexShaderSource = GLSL(440,
+	layout(location = 0) in vec3 position;
+	layout(location = 1) in vec3 normal;
+	layout(location = 2) in vec2 textureCoordinate;
+	layout(location = 3) in uvec2 drawInfo; // per-draw texture layer and model index, advanced by baseInstance
 
-	UCreateMesh(gMesh);
+	out vec3 vertexNormal;
+	out vec3 vertexFragmentPos;
+	out vec2 vertexTextureCoordinate;
+	flat out uint vertexLayer;
 
-	if (!UCreateShaderProgram(objectVertexShaderSource, objectFragmentShaderSource, gProgramId))
-		return EXIT_FAILURE;
+	struct Light {
+		vec3 position;
+		vec3 ambient;
+		vec3 diffuse;
+		vec3 specular;
 
-	// Telling OpenGL which texture the sample is connected to, which is unit 0
-	glUseProgram(gProgramId);
+		float constant;
+		float linear;
+		float quadratic;
+	};
 
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	layout(std140, binding = 0) uniform FrameBlock
+	{
+		mat4 view;
+		mat4 projection;
+		vec3 viewPosition;
+		vec3 lightPos;
+		Light light;
+	};
 
-	// render loop
-	while (!glfwWindowShouldClose(gWindow))
+	layout(std430, binding = 4) readonly buffer DrawBlock
 	{
-		UProcessInput(gWindow);
+		mat4 drawModels[];
+	};
 
-		// bind texture on corresponding texture unit
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture0);
+	void main()
+	{
+		mat4 model = drawModels[drawInfo.y];
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texture1);
+		gl_Position = projection * view * model * vec4(position, 1.0f);
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, texture2);
+		vertexFragmentPos = vec3(model * vec4(position, 1.0f));
 
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, texture3);
+		vertexNormal = mat3(transpose(inverse(model))) * normal;
+		vertexTextureCoordinate = textureCoordinate;
+		vertexLayer = drawInfo.x;
+	}
+);
 
-		URender();
+// Fragment shader for the batched path: same Phong lighting, sampling a texture array layer
+const GLchar* batchFragmentShaderSource = GLSL(440,
+	in vec3 vertexNormal;
+	in vec3 vertexFragmentPos;
+	in vec2 vertexTextureCoordinate;
+	flat in uint vertexLayer;
 
-		glfwPollEvents();
+	struct Light {
+		vec3 position;
+		vec3 ambient;
+		vec3 diffuse;
+		vec3 specular;
 
-		glfwSetCursorPosCallback(gWindow, mouse_callback);
-	}
+		float constant;
+		float linear;
+		float quadratic;
+	};
 
-	UDestroyMesh(gMesh);
+	out vec4 fragmentColor;
 
-	// release textures
-	UDestroyTexture(texture0);
-	UDestroyTexture(texture1);
-	UDestroyTexture(texture2);
-	UDestroyTexture(texture3);
+	layout(std140, binding = 0) uniform FrameBlock
+	{
+		mat4 view;
+		mat4 projection;
+		vec3 viewPosition;
+		vec3 lightPos;
+		Light light;
+	};
+
+	layout(binding = 4) uniform sampler2DArray uTextures; // TEXTURE_ARRAY_UNIT
+
+	void main()
+	{
+		vec3 color = texture(uTextures, vec3(vertexTextureCoordinate, float(vertexLayer))).rgb;
+
+		// Calc ambient lighting
+		vec3 ambient = light.ambient * color;
+
+		// Calc Diffuse Lighting
+		vec3 norm = normalize(vertexNormal);
+		vec3 lightDirection = normalize(lightPos - vertexFragmentPos);
+		float impact = max(dot(norm, lightDirection), 0.0);
+		vec3 diffuse = light.diffuse * impact * color;
+
+		// Calc Specular lighting
+		float highlightSize = 32.0f;
+		vec3 viewDir = normalize(viewPosition - vertexFragmentPos);
+		vec3 reflectDir = reflect(-lightDirection, norm);
+		float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+		vec3 specular = light.specular * specularComponent * color;
+
+		// attenuation
+		float distance = length(light.position - vertexFragmentPos);
+		float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+		fragmentColor = vec4((ambient + diffuse + specular) * attenuation, 1.0);
+	}
+);
+
+// Vertex shader for instanced props: the model matrix comes from InstanceBlock[instanceIndex]
+const GLchar* instanceVertexShaderSource = GLSL(440,
+	layout(location = 0) in vec3 position;
+	layout(location = 1) in vec3 normal;
+	layout(location = 2) in vec2 textureCoordinate;
+	layout(location = 3) in uint instanceIndex; // per-instance attribute read from the visible list
+
+	out vec3 vertexNormal;
+	out vec3 vertexFragmentPos;
+	out vec2 vertexTextureCoordinate;
+
+	struct Light {
+		vec3 position;
+		vec3 ambient;
+		vec3 diffuse;
+		vec3 specular;
+
+		float constant;
+		float linear;
+		float quadratic;
+	};
+
+	layout(std140, binding = 0) uniform FrameBlock
+	{
+		mat4 view;
+		mat4 projection;
+		vec3 viewPosition;
+		vec3 lightPos;
+		Light light;
+	};
+
+	// One model matrix per instance
+	layout(std430, binding = 1) readonly buffer InstanceBlock
+	{
+		mat4 instanceModels[];
+	};
+
+	void main()
+	{
+		mat4 model = instanceModels[instanceIndex];
+
+		gl_Position = projection * view * model * vec4(position, 1.0f);
+
+		vertexFragmentPos = vec3(model * vec4(position, 1.0f));
+
+		// Instances only use uniform scale, so the upper 3x3 is a valid normal matrix
+		// (the fragment shader normalizes) and the per-vertex inverse can be skipped
+		vertexNormal = mat3(model) * normal;
+		vertexTextureCoordinate = textureCoordinate;
+	}
+);
+
+// Compute shader for instance culling: tests each instance's bounding sphere against the
+// frustum and appends survivors to the visible list, counting them in the indirect command
+const GLchar* cullComputeShaderSource = GLSL(440,
+	layout(local_size_x = 64) in; // CULL_GROUP_SIZE
+
+	struct DrawCommand {
+		uint count;
+		uint instanceCount;
+		uint first;
+		uint baseInstance;
+	};
+
+	layout(std430, binding = 1) readonly buffer InstanceBlock
+	{
+		mat4 instanceModels[];
+	};
+
+	layout(std430, binding = 2) writeonly buffer VisibleBlock
+	{
+		uint visibleInstances[];
+	};
+
+	layout(std430, binding = 3) buffer CommandBlock
+	{
+		DrawCommand command;
+	};
+
+	uniform vec4 frustumPlanes[6];
+	uniform vec4 boundingSphere; // object-space center in xyz, radius in w
+	uniform uint instanceCount;
+
+	void main()
+	{
+		uint index = gl_GlobalInvocationID.x;
+		if (index >= instanceCount)
+			return;
+
+		mat4 model = instanceModels[index];
+		vec3 center = vec3(model * vec4(boundingSphere.xyz, 1.0));
+		float scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+		float radius = boundingSphere.w * scale;
+
+		for (int i = 0; i < 6; ++i)
+		{
+			if (dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius)
+				return;
+		}
+
+		uint slot = atomicAdd(command.instanceCount, 1u);
+		visibleInstances[command.baseInstance + slot] = index;
+	}
+);
+
+int main(int argc, char* argv[])
+{
+	const uint64_t startupBegin = UNowNanoseconds();
+	UTraceStart();
+	UTraceRegisterThread("main");
+
+	if (!UInitialize(argc, argv, &gWindow))
+		return EXIT_FAILURE;
+
+	// Nothing is known about the new context yet
+	UStateReset(gState);
+
+	// Scene work is spread over the cores; GL calls stay on this thread
+	if (gWorkerCount < 0)
+		gWorkerCount = std::max(0, int(std::thread::hardware_concurrency()) - 1);
+	UJobsStart(gJobs, unsigned(gWorkerCount));
+	JobsScope jobsScope(gJobs);
+	gCommandLists.resize(size_t(gWorkerCount) + 1);
+
+	UCreateMesh(gMesh);
+	UCreateScene(gMesh, gTransforms);
+
+	if (!UCreateShaderProgram(objectVertexShaderSource, objectFragmentShaderSource, gProgram))
+		return EXIT_FAILURE;
+
+	// Resolving the handles URender needs once, instead of every frame
+	gObjectUniforms.model = UGetUniform(gProgram, "model", GL_FLOAT_MAT4);
+	gObjectUniforms.uTexture = UGetUniform(gProgram, "uTexture", GL_SAMPLER_2D);
+	if (!UCheckUniformBlock(gProgram, "FrameBlock", FRAME_BLOCK_BINDING, sizeof(FrameConstants)))
+		return EXIT_FAILURE;
+
+	// Sizing the regions for everything a frame writes: the frame constants, the batch's model matrices
+	// and the stress instances' matrices and indirect command
+	GLsizeiptr streamRegionSize = sizeof(FrameConstants) + STREAM_ALIGNMENT_RESERVE;
+	if (gBatchedPath)
+		streamRegionSize += GLsizeiptr(gMesh.submeshes.size() * sizeof(glm::mat4)) + STREAM_ALIGNMENT_RESERVE;
+	if (gStressCount > 0)
+		streamRegionSize += GLsizeiptr(gStressCount) * sizeof(glm::mat4) + sizeof(DrawArraysIndirectCommand) + 2 * STREAM_ALIGNMENT_RESERVE;
+	if (!UCreateStreamBuffer(gStream, streamRegionSize))
+		return EXIT_FAILURE;
+
+	// Off unless asked for; a disabled profiler turns every scope into an early return
+	gGpuProfiler.enabled = gGpuTimers;
+	if (gGpuTimers)
+		UGpuProfilerCreate(gGpuProfiler);
+
+	// Optional single-draw path
+	if (gBatchedPath)
+	{
+		if (!UCreateShaderProgram(batchVertexShaderSource, batchFragmentShaderSource, gBatchProgram))
+			return EXIT_FAILURE;
+		if (!UCheckUniformBlock(gBatchProgram, "FrameBlock", FRAME_BLOCK_BINDING, sizeof(FrameConstants)))
+			return EXIT_FAILURE;
+
+		if (!UCreateBatch(gMesh, gBatch))
+			return EXIT_FAILURE;
+		UUpdateBatchModels(gMesh, gTransforms, gBatch);
+	}
+
+	// Optional instancing stress test
+	if (gStressCount > 0)
+	{
+		if (!UCreateShaderProgram(instanceVertexShaderSource, objectFragmentShaderSource, gInstanceProgram))
+			return EXIT_FAILURE;
+		gInstanceTextureLoc = UGetUniform(gInstanceProgram, "uTexture", GL_SAMPLER_2D);
+
+		const GLSubmesh* cube = UFindSubmesh(gMesh, "rubikscube");
+		if (!cube)
+			return EXIT_FAILURE;
+		UCreateStressInstances(gMesh, *cube, gStressCount, gInstances, gInstanceTransforms);
+
+		if (gGpuCulling)
+		{
+			if (!UCreateComputeProgram(cullComputeShaderSource, gCullProgram))
+				return EXIT_FAILURE;
+			gCullUniforms.frustumPlanes = UGetUniform(gCullProgram, "frustumPlanes", GL_FLOAT_VEC4);
+			gCullUniforms.boundingSphere = UGetUniform(gCullProgram, "boundingSphere", GL_FLOAT_VEC4);
+			gCullUniforms.instanceCount = UGetUniform(gCullProgram, "instanceCount", GL_UNSIGNED_INT);
+		}
+	}
+
+	// Telling OpenGL which texture the sample is connected to, which is unit 0
+	UStateUseProgram(gState, gProgram.id);
+
+	UStateClearColor(gState, 0.0f, 0.0f, 0.0f, 1.0f);
+
+	// Run once with --no-shader-cache and once without to see what the cache saves
+	LOG(LOG_INFO) << "Startup: " << (UNowNanoseconds() - startupBegin) / 1e6 << " ms, of which "
+		<< gProgramCacheStats.nanoseconds / 1e6 << " ms creating programs (" << gProgramCacheStats.hits << " from the cache, "
+		<< gProgramCacheStats.misses << " compiled)";
+
+	// Measuring a scripted flight, drawing a fixed number of frames offscreen, or running the interactive window until it is closed
+	if (gBenchmarkFrames > 0)
+	{
+		if (!URunBenchmark())
+			return EXIT_FAILURE;
+	}
+	else if (gHeadlessFrames > 0)
+	{
+		if (!URunHeadless())
+			return EXIT_FAILURE;
+	}
+	else if (gTickTestSeconds > 0.0)
+	{
+		if (!URunTickTest())
+			return EXIT_FAILURE;
+	}
+	else
+		URunWindowed(0.0);
+
+	if (gGpuTimers)
+		UGpuProfilerDestroy(gGpuProfiler);
+	if (gTraceFile)
+		UWriteChromeTrace(gTraceFile);
+
+	UDestroyMesh(gMesh);
+
+	// release textures
+	UDestroyTexture(texture0);
+	UDestroyTexture(texture1);
+	UDestroyTexture(texture2);
+	UDestroyTexture(texture3);
+
+	UDestroyShaderProgram(gProgram);
+
+	if (gBatchedPath)
+	{
+		UDestroyBatch(gBatch);
+		UDestroyShaderProgram(gBatchProgram);
+	}
+
+	if (gStressCount > 0)
+	{
+		UDestroyInstances(gInstances);
+		UDestroyShaderProgram(gInstanceProgram);
+		if (gGpuCulling)
+			UDestroyShaderProgram(gCullProgram);
+	}
 
-	UDestroyShaderProgram(gProgramId);
+	UDestroyStreamBuffer(gStream);
+
+	UJobsStop(gJobs);
 
 	exit(EXIT_SUCCESS);
 }
 
 bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 {
+	TRACE_ZONE("UInitialize");
+
+	UInputBindDefaults(gInput);
+
+	// Command line options
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--batched") == 0)
+			gBatchedPath = true;
+		else if (strcmp(argv[i], "--stress") == 0)
+		{
+			// Optional instance count after the flag
+			gStressCount = DEFAULT_STRESS_COUNT;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gStressCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-cull") == 0)
+			gGpuCulling = false;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			gWorkerCount = std::max(0, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--headless") == 0)
+		{
+			// Optional frame count after the flag
+			gHeadlessFrames = DEFAULT_HEADLESS_FRAMES;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--tick-test") == 0)
+		{
+			// Optional duration after the flag
+			gTickTestSeconds = DEFAULT_TICK_TEST_SECONDS;
+			if (i + 1 < argc && atof(argv[i + 1]) > 0.0)
+				gTickTestSeconds = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--render-delay") == 0 && i + 1 < argc)
+			gRenderDelayMs = std::max(0, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc)
+			gDumpPrefix = argv[++i];
+		else if (strcmp(argv[i], "--benchmark") == 0)
+		{
+			// Optional frame count after the flag
+			gBenchmarkFrames = DEFAULT_BENCHMARK_FRAMES;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gBenchmarkFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+			gPathFile = argv[++i];
+		else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc)
+			gReportFile = argv[++i];
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			gRecordFile = argv[++i];
+		else if (strcmp(argv[i], "--gpu-timers") == 0)
+			gGpuTimers = true;
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			gTraceFile = argv[++i];
+		else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc)
+			gLogFile = argv[++i];
+		else if (strcmp(argv[i], "--latency") == 0)
+			gLatencyStats = true;
+		else if (strcmp(argv[i], "--late-latch") == 0)
+			gLateLatch = true;
+		else if (strcmp(argv[i], "--idle") == 0)
+			gIdleRendering = true;
+		else if (strcmp(argv[i], "--vsync") == 0 && i + 1 < argc)
+		{
+			const char* name = argv[++i];
+			const int modeCount = int(sizeof(SWAP_MODE_NAMES) / sizeof(SWAP_MODE_NAMES[0]));
+			int mode = 1;
+			while (mode < modeCount && strcmp(name, SWAP_MODE_NAMES[mode]) != 0)
+				++mode;
+			if (mode < modeCount)
+				gSwapMode = SwapMode(mode);
+			else
+				LOG(LOG_WARNING) << "Unknown vsync mode " << name;
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+			gTargetFps = std::max(0.0, atof(argv[++i]));
+		else if (strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc)
+			gShaderCachePrefix = argv[++i];
+		else if (strcmp(argv[i], "--no-shader-cache") == 0)
+			gShaderCachePrefix = nullptr;
+		else if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc)
+		{
+			if (!UInputBind(gInput, argv[++i]))
+				LOG(LOG_WARNING) << "Ignoring binding " << argv[i] << ", expected <action>=<key>";
+		}
+		else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc)
+		{
+			const char* name = argv[++i];
+			const int levelCount = int(sizeof(LOG_LEVEL_NAMES) / sizeof(LOG_LEVEL_NAMES[0]));
+			int level = 0;
+			while (level < levelCount && strcmp(name, LOG_LEVEL_NAMES[level]) != 0)
+				++level;
+			if (level < levelCount)
+				gLogLevel = LogLevel(level);
+			else
+				LOG(LOG_WARNING) << "Unknown log level " << name;
+		}
+		else
+			LOG(LOG_WARNING) << "Unknown option " << argv[i];
+	}
+	if (gDumpPrefix && gHeadlessFrames == 0)
+		LOG(LOG_WARNING) << "--dump only applies with --headless";
+
+	// Messages so far went straight out; from here on they go through the writer thread
+	ULogStart(gLogFile);
+
 	glfwInit(); // initializing GLFW library
 	// Setting OpenGL versions
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -284,12 +1959,17 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+	// Headless runs still need a window for the context, but it is never shown and never presented.
+	// On hosts without a GPU, Mesa's llvmpipe provides the context (LIBGL_ALWAYS_SOFTWARE=1 forces it)
+	if (gHeadlessFrames > 0 || gTickTestSeconds > 0.0)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
 	// Creating GLFW window using previously defined variables
 	* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
 	// If creation fails, alert user and terminate
 	if (*window == NULL)
 	{
-		std::cout << "Failed to create GLFW window" << std::endl;
+		LOG(LOG_ERROR) << "Failed to create GLFW window";
 		glfwTerminate();
 		return false;
 	}
@@ -297,10 +1977,18 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 	// setting window context as current and setting framebuffer resize callback of window
 	glfwMakeContextCurrent(*window);
 	glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-	glfwSetScrollCallback(*window, UMouseScrollCallback);
+
+	// Only the interactive loop consumes input events, so the other modes don't queue them
+	if (gHeadlessFrames == 0 && gBenchmarkFrames == 0)
+	{
+		glfwSetKeyCallback(*window, UKeyCallback);
+		glfwSetCursorPosCallback(*window, mouse_callback);
+		glfwSetScrollCallback(*window, UMouseScrollCallback);
+	}
 
 	// When window has focus on PC, disable mouse cursor
-	glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	if (gHeadlessFrames == 0 && gTickTestSeconds == 0.0)
+		glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	// Enabling use of experimental/pre-release drivers
 	glewExperimental = GL_TRUE;
@@ -309,136 +1997,257 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 	// Ensuring GLEW properly initialized
 	if (GLEW_OK != GlewInitResult)
 	{
-		std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
+		LOG(LOG_ERROR) << glewGetErrorString(GlewInitResult);
 		return false;
 	}
 
 	// Displaying GPU OpenGL version
-	cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+	LOG(LOG_INFO) << "OpenGL Version: " << glGetString(GL_VERSION);
+
+	// The interval belongs to the window, so it holds whichever thread later makes the context current
+	if (gSwapMode == SWAP_DEFAULT)
+		USetSwapInterval(gBenchmarkFrames > 0 ? SWAP_OFF : SWAP_ON);
+	else
+		USetSwapInterval(gSwapMode);
 
 	return true;
 }
 
-// if declared key(s) are pressed during this frame, do something
+// applies the events since the last simulation tick, then does something for the keys held down
 void UProcessInput(GLFWwindow* window)
 {
-	// Checking if 'escape' key was pressed. If so, close window.
-	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-		glfwSetWindowShouldClose(window, true);
+	TRACE_ZONE("UProcessInput");
+
+	// Events apply in arrival order, so a key tapped between two ticks still registers
+	gInput.tickEventTime = gInput.events.empty() ? 0.0 : gInput.events.front().time;
+	for (const InputEvent& event : gInput.events)
+	{
+		switch (event.type)
+		{
+		case INPUT_KEY:
+			UApplyKeyEvent(window, gInput, event);
+			break;
+		case INPUT_CURSOR:
+			UApplyCursor(event.x, event.y);
+			break;
+		case INPUT_SCROLL:
+			if (event.y > 0)
+			{
+				scrollSpeed += 0.01;
+			}
+			else
+			{
+				if (scrollSpeed > 0.01) // limiting speed to a minimum of 0.
+				{
+					scrollSpeed -= 0.01;
+				}
+			}
+			LOG(LOG_INFO) << scrollSpeed;
+			break;
+		}
+	}
+	gInput.events.clear();
 
-	const float cameraSpeed = 2.5f * scrollSpeed;
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+	const unsigned char* held = gInput.actionKeys;
+	const float cameraSpeed = CAMERA_SPEED * scrollSpeed * deltaTime;
+	if (held[ACTION_FORWARD])
 		cameraPos += cameraSpeed * cameraFront;
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+	if (held[ACTION_BACK])
 		cameraPos -= cameraSpeed * cameraFront;
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+	if (held[ACTION_RIGHT])
 		cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+	if (held[ACTION_LEFT])
 		cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+	if (held[ACTION_DOWN])
 		cameraPos -= cameraSpeed * cameraUp;
-	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+	if (held[ACTION_UP])
 		cameraPos += cameraSpeed * cameraUp;
-	if (glfwGetKey(window, GLFW_KEY_LEFT))
+	if (held[ACTION_LIGHT_LEFT])
 	{
-		lX -= 0.01;
-		cout << lX << endl;
+		lX -= LIGHT_SPEED * deltaTime;
+		LOG(LOG_INFO) << lX;
 	}
-	if (glfwGetKey(window, GLFW_KEY_RIGHT))
+	if (held[ACTION_LIGHT_RIGHT])
 	{
-		lX += 0.01;
-		cout << lX << endl;
+		lX += LIGHT_SPEED * deltaTime;
+		LOG(LOG_INFO) << lX;
 	}
-	if (glfwGetKey(window, GLFW_KEY_UP))
+	if (held[ACTION_LIGHT_UP])
 	{
-		lY += 0.01;
-		cout << lY << endl;
+		lY += LIGHT_SPEED * deltaTime;
+		LOG(LOG_INFO) << lY;
 	}
-	if (glfwGetKey(window, GLFW_KEY_DOWN))
+	if (held[ACTION_LIGHT_DOWN])
 	{
-		lY -= 0.01;
-		cout << lY << endl;
+		lY -= LIGHT_SPEED * deltaTime;
+		LOG(LOG_INFO) << lY;
 	}
-	if (glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT))
+	if (held[ACTION_LIGHT_NEAR])
 	{
-		lZ += 0.01;
-		cout << lZ << endl;
+		lZ += LIGHT_SPEED * deltaTime;
+		LOG(LOG_INFO) << lZ;
 	}
-	if (glfwGetKey(window, GLFW_KEY_RIGHT_CONTROL))
+	if (held[ACTION_LIGHT_FAR])
 	{
-		lZ -= 0.01;
-		cout << lZ << endl;
+		lZ -= LIGHT_SPEED * deltaTime;
+		LOG(LOG_INFO) << lZ;
 	}
+}
 
-	// press "p" to change projections
-	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
+void UApplyKeyEvent(GLFWwindow* window, InputState& input, const InputEvent& event)
+{
+	// Skipping presses of keys already down and releases of keys already up, which focus changes can produce
+	if (input.keys[event.key] == event.pressed)
+		return;
+	input.keys[event.key] = event.pressed;
+
+	const InputAction action = input.keyActions[event.key];
+	if (action == ACTION_NONE)
+		return;
+	if (!event.pressed)
 	{
-		// Checking to see if projection was changed on last frame
-		if (!lastFrameCheck)
-		{
-			perspective = !perspective;
-			cout << "Projection Changed" << endl;
-			lastFrameCheck = true;
-		}
-		else
-		{
-			lastFrameCheck = false;
-		}
+		--input.actionKeys[action];
+		return;
+	}
+	++input.actionKeys[action];
 
+	// One-shot actions fire on the press itself, once however long the key is held
+	if (action == ACTION_QUIT)
+		glfwSetWindowShouldClose(window, true);
+	else if (action == ACTION_TOGGLE_PROJECTION)
+	{
+		perspective = !perspective;
+		LOG(LOG_INFO) << "Projection Changed";
 	}
+	else if (action == ACTION_TURN_CUBE)
+		cubeTurn = std::fmod(cubeTurn + CUBE_TURN_STEP, 360.0f);
 }
 
+void UKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	// Repeats carry nothing the held state doesn't already
+	if (key < 0 || key > GLFW_KEY_LAST || action == GLFW_REPEAT)
+		return;
+
+	InputEvent event;
+	event.type = INPUT_KEY;
+	event.time = glfwGetTime();
+	event.key = key;
+	event.pressed = action == GLFW_PRESS;
+	event.x = event.y = 0.0;
+	gInput.events.push_back(event);
+}
 
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 {
-	if (yoffset > 0)
+	InputEvent event;
+	event.type = INPUT_SCROLL;
+	event.time = glfwGetTime();
+	event.key = GLFW_KEY_UNKNOWN;
+	event.pressed = false;
+	event.x = xoffset;
+	event.y = yoffset;
+	gInput.events.push_back(event);
+}
+
+void UInputBindDefaults(InputState& input)
+{
+	std::fill(std::begin(input.keyActions), std::end(input.keyActions), ACTION_NONE);
+	std::fill(std::begin(input.actionKeys), std::end(input.actionKeys), 0);
+	for (const KeyBinding& binding : DEFAULT_BINDINGS)
+		input.keyActions[binding.key] = binding.action;
+}
+
+bool UInputBind(InputState& input, const char* binding)
+{
+	const char* separator = strchr(binding, '=');
+	if (!separator)
+		return false;
+
+	const std::string actionName(binding, separator);
+	int action = 0;
+	while (action < ACTION_COUNT && actionName != ACTION_NAMES[action])
+		++action;
+	const int key = UParseKey(separator + 1);
+	if (action == ACTION_COUNT || key == GLFW_KEY_UNKNOWN)
+		return false;
+
+	// A key drives one action, so binding it again replaces what it did before
+	input.keyActions[key] = InputAction(action);
+	return true;
+}
+
+int UParseKey(const char* name)
+{
+	// Letters and digits are their own GLFW key codes
+	if (name[0] != '\0' && name[1] == '\0')
 	{
-		scrollSpeed += 0.01;
+		const char c = char(toupper((unsigned char)name[0]));
+		if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+			return c;
 	}
-	else
+
+	for (const KeyName& keyName : KEY_NAMES)
 	{
-		if (scrollSpeed > 0.01) // limiting speed to a minimum of 0.
-		{
-			scrollSpeed -= 0.01;
-		}
+		if (strcmp(name, keyName.name) == 0)
+			return keyName.key;
 	}
-	cout << scrollSpeed << endl;
+
+	const int code = atoi(name);
+	if (code > 0 && code <= GLFW_KEY_LAST)
+		return code;
+	return GLFW_KEY_UNKNOWN;
 }
 
-// Set viewport if window is resized
+// Set viewport if window is resized. Runs on the main thread, so the render thread applies it
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
-	glViewport(0, 0, width, height);
+	gResizePending = true;
+	gResizeWidth = width;
+	gResizeHeight = height;
 }
 
 // URender will render the frame. This function is in the while loop within main()
 void URender()
 {
+	TRACE_ZONE("URender");
+	UTraceCheckDumpRequest();
+
+	// Claiming this frame's region of the stream buffer, waiting only if the GPU is still on it
+	UStreamBeginFrame(gStream);
+	UGpuProfilerBeginFrame(gGpuProfiler);
+	gFrameDrawCalls = 0;
+
+	// bind texture on corresponding texture unit, only reaches GL when a binding changed
+	UStateBindTexture(gState, 0, GL_TEXTURE_2D, texture0);
+	UStateBindTexture(gState, 1, GL_TEXTURE_2D, texture1);
+	UStateBindTexture(gState, 2, GL_TEXTURE_2D, texture2);
+	UStateBindTexture(gState, 3, GL_TEXTURE_2D, texture3);
+
 	// Lamp orbits around the origin
-	gLightPosition.x = lX;
-	gLightPosition.y = lY;
-	gLightPosition.z = lZ;
+	gLightPosition = gRenderCamera.light;
 
 	// Enabling z-depth
-	glEnable(GL_DEPTH_TEST);
+	UStateSetEnabled(gState, GL_DEPTH_TEST, true);
 
 	// Clear frame to black, clear the z buffers
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	UStateClearColor(gState, 0.0f, 0.0f, 0.0f, 1.0f);
+	const unsigned clearScope = UGpuScopeBegin(gGpuProfiler, "clear");
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	UGpuScopeEnd(gGpuProfiler, clearScope);
 
-	// Activate VAO
-	glBindVertexArray(gMesh.vao);
+	// Only a new turn touches the cube's node, so a still cube costs nothing below
+	if (gRenderCamera.cubeTurn != gAppliedCubeTurn)
+		UTurnCube(gMesh, gTransforms, gRenderCamera.cubeTurn);
 
-	// 1. Scales the object by 2
-	glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-	// 2. Place object at the origin
-	glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-	// Model matrix: transformations are applied right-to-left order
-	glm::mat4 model = translation * scale;
+	// Refreshing the world matrices of whatever moved since the last frame
+	const size_t movedNodes = UTransformUpdate(gTransforms);
+	if (gBatchedPath && movedNodes > 0)
+		UUpdateBatchModels(gMesh, gTransforms, gBatch);
 
 	// Defining perspective projection to start, however pressing P will change perspective to ortho
 	glm::mat4 projection = glm::perspective(1.0f, GLfloat(WINDOW_WIDTH / WINDOW_HEIGHT), 0.1f, 100.0f);
-	if (perspective)
+	if (gRenderCamera.perspective)
 	{
 		projection = glm::perspective(1.0f, GLfloat(WINDOW_WIDTH / WINDOW_HEIGHT), 0.1f, 100.0f);
 	}
@@ -452,65 +2261,130 @@ void URender()
 	float camZ = cos(glfwGetTime()) * radius;
 
 	// new camera view that allows movement. commented out for now
-	glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-
-	glUseProgram(gProgramId);
-
-	// Program 1
-	GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-	GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-	GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-	// Reference matrix uniforms for Shader program
-	GLint lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-	GLint viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
-	GLfloat lightConstantLoc = glGetUniformLocation(gProgramId, "light.constant");
-	GLfloat lightLinearLoc = glGetUniformLocation(gProgramId, "light.linear");
-	GLfloat lightQuadraticLoc = glGetUniformLocation(gProgramId, "light.quadratic");
-	GLint lightAmbientLoc = glGetUniformLocation(gProgramId, "light.ambient");
-	GLint lightDiffuseLoc = glGetUniformLocation(gProgramId, "light.diffuse");
-	GLint lightSpecularLoc = glGetUniformLocation(gProgramId, "light.specular");
-
-
-	// Pass color, light, and camera data to the pyramid Shader program's corresponding uniforms
-	glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-	const glm::vec3 cameraPosition = (cameraPos, cameraPos + cameraFront, cameraUp);
-	glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+	glm::mat4 view = glm::lookAt(gRenderCamera.position, gRenderCamera.position + gRenderCamera.front, gRenderCamera.up);
+
+	// Camera and light data for every program, written with a single buffer update
+	FrameConstants frame = {};
+	frame.view = view;
+	frame.projection = projection;
+	const glm::vec3 cameraPosition = (gRenderCamera.position, gRenderCamera.position + gRenderCamera.front, gRenderCamera.up);
+	frame.viewPosition = cameraPosition;
+	frame.lightPos = gLightPosition;
+	// light.position was never uploaded as a separate uniform, so attenuation stays centered on the origin
+	frame.lightPosition = glm::vec3(0.0f);
 	// Setting float variables for caster
-	glUniform3f(lightAmbientLoc, 0.1f, 0.1f, 0.1f);
-	glUniform3f(lightDiffuseLoc, 0.8f, 0.8f, 0.8f);
-	glUniform3f(lightSpecularLoc, 1.0f, 1.0f, 1.0f);
-	glUniform1f(lightConstantLoc, 1.0f);
-	glUniform1f(lightLinearLoc, 0.09f);
-	glUniform1f(lightQuadraticLoc, 0.032f);
+	frame.lightAmbient = glm::vec3(0.1f, 0.1f, 0.1f);
+	frame.lightDiffuse = glm::vec3(0.8f, 0.8f, 0.8f);
+	frame.lightSpecular = glm::vec3(1.0f, 1.0f, 1.0f);
+	frame.lightConstant = 1.0f;
+	frame.lightLinear = 0.09f;
+	frame.lightQuadratic = 0.032f;
+
+	GLintptr frameOffset;
+	FrameConstants* mappedFrame = nullptr;
+	if (void* data = UStreamAllocate(gStream, sizeof(FrameConstants), frameOffset))
+	{
+		memcpy(data, &frame, sizeof(FrameConstants));
+		UStateBindBufferRange(gState, GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, gStream.buffer, frameOffset, sizeof(FrameConstants));
+		mappedFrame = static_cast<FrameConstants*>(data);
+	}
 
-	// Loading textures and drawing objects
-	// Marble texture
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-	// Tabletop vertices
-	glDrawArrays(GL_TRIANGLES, 0, gMesh.nIndices + 6);
-	// Book Cover Texture
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 1);
-	// Book
-	glDrawArrays(GL_TRIANGLES, 0, gMesh.nIndices + 42);
+	// Drawing each object (tabletop, book, Rubik's cube) exactly once with its own texture
+#ifdef _DEBUG
+	UBeginRangeOverlapCheck(gMesh);
+#endif
+	if (gBatchedPath)
+	{
+		UStateUseProgram(gState, gBatchProgram.id);
+		if (gLateLatch && mappedFrame)
+			ULateLatchView(*mappedFrame);
+		const unsigned batchScope = UGpuScopeBegin(gGpuProfiler, "batch");
+		UDrawBatch(gMesh, gBatch);
+		UGpuScopeEnd(gGpuProfiler, batchScope);
+	}
+	else
+	{
+		// Workers cull and record the submeshes into their own lists
+		for (CommandList& list : gCommandLists)
+		{
+			list.keys.clear();
+			list.items.clear();
+		}
+		const glm::mat4 viewProjection = projection * view;
+		UJobsParallelFor(gJobs, gMesh.submeshes.size(), SUBMESH_JOB_GRAIN, [&](size_t begin, size_t end, unsigned thread)
+		{
+			URecordSubmeshes(gCommandLists[thread], gMesh, begin, end, view, viewProjection);
+		});
+
+		// Merging the lists, then letting the sort pick the submission order
+		URenderQueueClear(gRenderQueue);
+		for (const CommandList& list : gCommandLists)
+		{
+			for (size_t i = 0; i < list.items.size(); ++i)
+				URenderQueuePush(gRenderQueue, list.keys[i], list.items[i]);
+		}
+		URenderQueueSort(gRenderQueue);
+
+		// The mapped constants are coherent and no draw has read them yet, so the view can still change.
+		// Culling used the older view; the look moves so little within a frame that edge objects still cover it
+		if (gLateLatch && mappedFrame)
+			ULateLatchView(*mappedFrame);
+		URenderQueueSubmit(gRenderQueue);
+	}
+#ifdef _DEBUG
+	UEndRangeOverlapCheck();
+#endif
+
+	// Instanced copies repeat the same vertex range on purpose, so they stay outside the range overlap check
+	if (gStressCount > 0)
+	{
+		UAnimateInstances(gInstanceTransforms, gInstances, gRenderCamera.simTime);
+		GLintptr commandOffset = -1;
+		if (gGpuCulling)
+		{
+			const unsigned cullScope = UGpuScopeBegin(gGpuProfiler, "instance cull");
+			commandOffset = UCullInstances(gInstances, projection * view);
+			UGpuScopeEnd(gGpuProfiler, cullScope);
+		}
+		const unsigned instanceScope = UGpuScopeBegin(gGpuProfiler, "instances");
+		UDrawInstances(gInstances, commandOffset);
+		UGpuScopeEnd(gGpuProfiler, instanceScope);
+	}
 
-	// Rubik's Cube Texture
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 2);
-	// Cube
-	glDrawArrays(GL_TRIANGLES, 0, gMesh.nIndices + 79);
+	// Everything this frame wrote to the stream buffer is now queued behind the fence
+	UStreamEndFrame(gStream);
 
-	glBindVertexArray(0);
+	UStateEndFrame(gState);
+}
 
-	glfwSwapBuffers(gWindow);
+GLSubmesh UMakeSubmesh(const char* name, GLint first, GLsizei count, GLint textureUnit, const GLfloat* verts, GLuint floatsPerVertex)
+{
+	GLSubmesh submesh;
+	submesh.name = name;
+	submesh.first = first;
+	submesh.count = count;
+	submesh.textureUnit = textureUnit;
+	// Drawn with the root node until UCreateScene gives the object its own
+	submesh.node = 0;
+
+	// Bounds of the range, used for depth sorting and culling
+	const GLfloat* position = verts + first * floatsPerVertex;
+	submesh.boundsMin = submesh.boundsMax = glm::vec3(position[0], position[1], position[2]);
+	for (GLsizei i = 1; i < count; ++i)
+	{
+		position += floatsPerVertex;
+		const glm::vec3 p(position[0], position[1], position[2]);
+		submesh.boundsMin = glm::min(submesh.boundsMin, p);
+		submesh.boundsMax = glm::max(submesh.boundsMax, p);
+	}
+	return submesh;
 }
 
 // UCreateMesh contains positions and color data, and ensures data is in GPU memory
 void UCreateMesh(GLMesh& mesh)
 {
+	TRACE_ZONE("UCreateMesh");
+
 	// Position, Normal, and texture data for objects
 	GLfloat verts[] = {
 		// Table top			// Plane Normal		// Texture Coords
@@ -614,23 +2488,31 @@ void UCreateMesh(GLMesh& mesh)
 	const GLuint floatsPerNormal = 3;
 	const GLuint floatsPerUV = 2;
 
-	// Basically setting a start point for drawing arrays
-	mesh.nIndices = 0;
+	const GLuint floatsPerVertexTotal = floatsPerVertex + floatsPerNormal + floatsPerUV;
+
+	// Total number of vertices in the buffer
+	mesh.nIndices = sizeof(verts) / (sizeof(verts[0]) * floatsPerVertexTotal);
+
+	// Draw ranges: 6 vertices for the tabletop, then 6 faces of 6 vertices for the book and the cube
+	mesh.submeshes.clear();
+	mesh.submeshes.push_back(UMakeSubmesh("tabletop", 0, 6, 0, verts, floatsPerVertexTotal));		// Marble texture
+	mesh.submeshes.push_back(UMakeSubmesh("book", 6, 36, 1, verts, floatsPerVertexTotal));			// Book Cover Texture
+	mesh.submeshes.push_back(UMakeSubmesh("rubikscube", 42, 36, 2, verts, floatsPerVertexTotal));	// Rubik's Cube Texture
 
 	// generating vertex array object names
 	glGenVertexArrays(1, &mesh.vao);
 	// Binding generated vertex array name
-	glBindVertexArray(mesh.vao);
+	UStateBindVertexArray(gState, mesh.vao);
 
 	// Generates buffers for vertex data and indices
 	glGenBuffers(1, &mesh.vbo);
 	// Binding vertex data
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	UStateBindBuffer(gState, GL_ARRAY_BUFFER, mesh.vbo);
 	// Sending vertex/coordinate data to GPU
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
 
-	// Setting stride, which is 5 (3 + 2)
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+	// Setting stride, which is 8 (3 + 3 + 2)
+	GLint stride = sizeof(float) * floatsPerVertexTotal;
 
 	// Creating vertex attrib pointers
 	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
@@ -642,29 +2524,14 @@ void UCreateMesh(GLMesh& mesh)
 	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
 	glEnableVertexAttribArray(2);
 
-	// Marble Texture
-	const char* texFilename = "../CS330 Mod6Milestone/Resources/Textures/marble.jfif";
-	if (!UCreateTexture(texFilename, texture0))
-	{
-		cout << "Failed to load texture " << texFilename << endl;
-	}
-	// Book Texture
-	texFilename = "../CS330 Mod6Milestone/Resources/Textures/gulagArchipelago.png";
-	if (!UCreateTexture(texFilename, texture1))
-	{
-		cout << "Failed to load texture " << texFilename << endl;
-	}
-	// Rubik's Cube Texture
-	texFilename = "../CS330 Mod6Milestone/Resources/Textures/rubikscube.png";
-	if (!UCreateTexture(texFilename, texture2))
-	{
-		cout << "Failed to load texture " << texFilename << endl;
-	}
-	// Dust Texture
-	texFilename = "../CS330 Mod6Milestone/Resources/Textures/dust.jpg";
-	if (!UCreateTexture(texFilename, texture3))
+	// Marble, book, Rubik's cube and dust textures
+	GLuint* textures[TEXTURE_COUNT] = { &texture0, &texture1, &texture2, &texture3 };
+	for (int i = 0; i < TEXTURE_COUNT; ++i)
 	{
-		cout << "Failed to load texture " << texFilename << endl;
+		if (!UCreateTexture(TEXTURE_FILES[i], *textures[i]))
+		{
+			LOG(LOG_ERROR) << "Failed to load texture " << TEXTURE_FILES[i];
+		}
 	}
 }
 
@@ -673,20 +2540,2195 @@ void UDestroyMesh(GLMesh& mesh)
 	// Delete mesh
 	glDeleteVertexArrays(1, &mesh.vao);
 	glDeleteBuffers(1, &mesh.vbo);
+	mesh.submeshes.clear();
+	UStateReset(gState);
+
+#ifdef _DEBUG
+	if (gPrimitivesQuery)
+		glDeleteQueries(1, &gPrimitivesQuery);
+	gPrimitivesQuery = 0;
+#endif
 }
 
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+uint64_t URenderKey(RenderPass pass, GLuint program, GLuint texture, GLuint vao, float depth, float farPlane)
 {
-	// for comp and linkage error reporting
-	int success = 0;
-	char infoLog[512];
+	// Quantizing depth to 24 bits over [0, farPlane]
+	float normalized = std::min(std::max(depth / farPlane, 0.0f), 1.0f);
+	if (pass != PASS_OPAQUE)
+		normalized = 1.0f - normalized;
+	const uint64_t quantized = uint64_t(normalized * SORT_KEY_DEPTH_MAX);
+
+	return (uint64_t(pass & 0x3) << SORT_KEY_PASS_SHIFT)
+		| (uint64_t(program & 0xFF) << SORT_KEY_PROGRAM_SHIFT)
+		| (uint64_t(texture & 0xFF) << SORT_KEY_TEXTURE_SHIFT)
+		| (uint64_t(vao & 0xFF) << SORT_KEY_VAO_SHIFT)
+		| (quantized << SORT_KEY_DEPTH_SHIFT);
+}
 
-	// Creating shader program object
-	programId = glCreateProgram();
+void URenderQueueClear(RenderQueue& queue)
+{
+	queue.items.clear();
+	queue.entries.clear();
+}
 
-	// Creating vertex and fragment shader objects
-	GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+void URenderQueuePush(RenderQueue& queue, uint64_t key, const DrawItem& item)
+{
+	queue.entries.push_back({ key, uint32_t(queue.items.size()) });
+	queue.items.push_back(item);
+}
+
+void URenderQueueSort(RenderQueue& queue)
+{
+	const size_t count = queue.entries.size();
+	if (count < 2)
+		return;
+	queue.scratch.resize(count);
+
+	SortEntry* src = queue.entries.data();
+	SortEntry* dst = queue.scratch.data();
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t offsets[256] = {};
+		for (size_t i = 0; i < count; ++i)
+			++offsets[(src[i].key >> shift) & 0xFF];
+
+		// Every key has the same digit, this pass would not move anything
+		if (offsets[(src[0].key >> shift) & 0xFF] == count)
+			continue;
+
+		size_t total = 0;
+		for (size_t& offset : offsets)
+		{
+			const size_t digitCount = offset;
+			offset = total;
+			total += digitCount;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+			dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+		std::swap(src, dst);
+	}
+
+	// An odd number of passes left the result in the scratch buffer
+	if (src != queue.entries.data())
+		queue.entries.swap(queue.scratch);
+}
+
+void URenderQueueSubmit(const RenderQueue& queue)
+{
+	const DrawItem* previous = nullptr;
+	for (const SortEntry& entry : queue.entries)
+	{
+		const DrawItem& item = queue.items[entry.index];
+		const bool programChanged = !previous || previous->program != item.program;
+
+		UStateUseProgram(gState, item.program);
+		UStateBindVertexArray(gState, item.vao);
+
+		// Uniforms belong to the program, so they are uploaded again whenever it changes
+		if (programChanged || previous->model != item.model)
+			glUniformMatrix4fv(item.modelLoc, 1, GL_FALSE, glm::value_ptr(item.model));
+		if (programChanged || previous->textureUnit != item.textureUnit)
+			glUniform1i(item.textureLoc, item.textureUnit);
+
+		const unsigned scope = UGpuScopeBegin(gGpuProfiler, item.name);
+		glDrawArrays(GL_TRIANGLES, item.first, item.count);
+		UGpuScopeEnd(gGpuProfiler, scope);
+		++gFrameDrawCalls;
+
+#ifdef _DEBUG
+		UCountDrawnVertices(item.first, item.count);
+#endif
+		previous = &item;
+	}
+}
+
+bool UCreateBatch(const GLMesh& mesh, GLBatch& batch)
+{
+	batch.drawCount = GLsizei(mesh.submeshes.size());
+
+	// One indirect command per submesh. baseInstance selects the draw's entry in the layer buffer,
+	// which holds its texture layer and the index of its model matrix
+	std::vector<DrawArraysIndirectCommand> commands;
+	std::vector<glm::uvec2> layers;
+	for (size_t i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		const GLSubmesh& submesh = mesh.submeshes[i];
+		commands.push_back({ GLuint(submesh.count), 1, GLuint(submesh.first), GLuint(i) });
+		layers.push_back(glm::uvec2(GLuint(submesh.textureUnit), GLuint(i)));
+	}
+
+	glGenBuffers(1, &batch.indirectBuffer);
+	UStateBindBuffer(gState, GL_DRAW_INDIRECT_BUFFER, batch.indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawArraysIndirectCommand), commands.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &batch.layerVbo);
+	UStateBindBuffer(gState, GL_ARRAY_BUFFER, batch.layerVbo);
+	glBufferData(GL_ARRAY_BUFFER, layers.size() * sizeof(glm::uvec2), layers.data(), GL_STATIC_DRAW);
+
+	// Filled by UUpdateBatchModels whenever a transform changes
+	glGenBuffers(1, &batch.modelBuffer);
+	UStateBindBuffer(gState, GL_SHADER_STORAGE_BUFFER, batch.modelBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, batch.drawCount * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+	UStateBindBufferBase(gState, GL_SHADER_STORAGE_BUFFER, DRAW_BLOCK_BINDING, batch.modelBuffer);
+
+	// Same vertex layout as the mesh's VAO, plus the per-draw layer and model index on location 3
+	glGenVertexArrays(1, &batch.vao);
+	UStateBindVertexArray(gState, batch.vao);
+	USetMeshAttributes(mesh);
+
+	UStateBindBuffer(gState, GL_ARRAY_BUFFER, batch.layerVbo);
+	glVertexAttribIPointer(3, 2, GL_UNSIGNED_INT, sizeof(glm::uvec2), 0);
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(3);
+
+	UStateBindVertexArray(gState, 0);
+
+	if (!UCreateTextureArray(TEXTURE_FILES, TEXTURE_COUNT, TEXTURE_ARRAY_SIZE, batch.textureArray))
+	{
+		LOG(LOG_ERROR) << "Failed to create texture array for the batched path";
+		return false;
+	}
+
+	// The array stays bound for the lifetime of the program
+	UStateBindTexture(gState, TEXTURE_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, batch.textureArray);
+
+	return true;
+}
+
+void UDestroyBatch(GLBatch& batch)
+{
+	glDeleteVertexArrays(1, &batch.vao);
+	glDeleteBuffers(1, &batch.layerVbo);
+	glDeleteBuffers(1, &batch.indirectBuffer);
+	glDeleteBuffers(1, &batch.modelBuffer);
+	glDeleteTextures(1, &batch.textureArray);
+
+	// Deleted names may be handed out again, so cached bindings can no longer be trusted
+	UStateReset(gState);
+}
+
+void UDrawBatch(const GLMesh& mesh, const GLBatch& batch)
+{
+	UStateBindVertexArray(gState, batch.vao);
+	UStateBindBuffer(gState, GL_DRAW_INDIRECT_BUFFER, batch.indirectBuffer);
+	glMultiDrawArraysIndirect(GL_TRIANGLES, 0, batch.drawCount, 0);
+	++gFrameDrawCalls;
+
+#ifdef _DEBUG
+	for (const GLSubmesh& submesh : mesh.submeshes)
+		UCountDrawnVertices(submesh.first, submesh.count);
+#else
+	// Only the range overlap check needs the submeshes
+	(void)mesh;
+#endif
+}
+
+const GLSubmesh* UFindSubmesh(const GLMesh& mesh, const char* name)
+{
+	for (const GLSubmesh& submesh : mesh.submeshes)
+		if (strcmp(submesh.name, name) == 0)
+			return &submesh;
+
+	LOG(LOG_ERROR) << "mesh has no submesh named " << name;
+	return nullptr;
+}
+
+void UCreateStressInstances(const GLMesh& mesh, const GLSubmesh& submesh, GLsizei count, GLInstances& instances, InstanceTransforms& transforms)
+{
+	instances.count = count;
+	instances.submesh = &submesh;
+
+	// Square grid over the tabletop, which spans [-2, 2] in world space once scaled by 2
+	const float tableHalfSize = 2.0f;
+	const int side = int(std::ceil(std::sqrt(double(count))));
+	const float cellSize = 2.0f * tableHalfSize / side;
+
+	// Each copy is scaled to fill 80% of a cell and rests its bottom face on the table
+	const glm::vec3 extent = submesh.boundsMax - submesh.boundsMin;
+	const float scale = 0.8f * cellSize / std::max(extent.x, extent.y);
+	transforms.pivot = glm::vec3(0.5f * (submesh.boundsMin.x + submesh.boundsMax.x), 0.5f * (submesh.boundsMin.y + submesh.boundsMax.y), submesh.boundsMin.z);
+
+	for (int c = 0; c < 3; ++c)
+	{
+		transforms.position[c].resize(count);
+		transforms.scale[c].assign(count, scale);
+	}
+	for (int c = 0; c < 4; ++c)
+		transforms.rotation[c].assign(count, 0.0f);
+	transforms.cellX.resize(count);
+	transforms.cellY.resize(count);
+	transforms.startZ.resize(count);
+	transforms.startW.resize(count);
+	transforms.reportSeconds = 0.0;
+	transforms.reportFrames = 0;
+	transforms.lastReportTime = glfwGetTime();
+
+	std::vector<GLuint> indices(count);
+	for (GLsizei i = 0; i < count; ++i)
+	{
+		transforms.cellX[i] = -tableHalfSize + (i % side + 0.5f) * cellSize;
+		transforms.cellY[i] = -tableHalfSize + (i / side + 0.5f) * cellSize;
+		// Staggering the starting angles so neighbours don't turn in lockstep
+		const float halfAngle = 0.5f * float(i) * 0.618034f;
+		transforms.startZ[i] = std::sin(halfAngle);
+		transforms.startW[i] = std::cos(halfAngle);
+		// Only the spin moves the base in x and y; its height on the table never changes
+		transforms.position[2][i] = -scale * transforms.pivot.z;
+		indices[i] = GLuint(i);
+	}
+
+	// Visible list, starting as every instance in order for when culling is off
+	glGenBuffers(1, &instances.visibleBuffer);
+	UStateBindBuffer(gState, GL_SHADER_STORAGE_BUFFER, instances.visibleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_DYNAMIC_COPY);
+
+	// Bound once; the instance and culling programs read the visible list from a fixed binding point.
+	// The instance and command blocks move through the stream buffer and are bound every frame
+	UStateBindBufferBase(gState, GL_SHADER_STORAGE_BUFFER, VISIBLE_BLOCK_BINDING, instances.visibleBuffer);
+
+	// Mesh layout plus the instance index on location 3, advancing once per instance
+	glGenVertexArrays(1, &instances.vao);
+	UStateBindVertexArray(gState, instances.vao);
+	USetMeshAttributes(mesh);
+
+	UStateBindBuffer(gState, GL_ARRAY_BUFFER, instances.visibleBuffer);
+	glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(3);
+
+	UStateBindVertexArray(gState, 0);
+}
+
+void UDestroyInstances(GLInstances& instances)
+{
+	glDeleteVertexArrays(1, &instances.vao);
+	glDeleteBuffers(1, &instances.visibleBuffer);
+	instances.visibleBuffer = 0;
+	instances.count = 0;
+	UStateReset(gState);
+}
+
+void UAnimateInstances(InstanceTransforms& transforms, const GLInstances& instances, double time)
+{
+	const double start = glfwGetTime();
+	const size_t count = size_t(instances.count);
+
+	// Every cube turns by the same angle, so the spin is one quaternion about z applied after each start rotation
+	const float halfAngle = 0.5f * INSTANCE_SPIN_SPEED * float(time);
+	const float spinZ = std::sin(halfAngle);
+	const float spinW = std::cos(halfAngle);
+
+	// This frame's region of the stream buffer is free of GPU reads, so the matrices go straight into it
+	const GLsizeiptr size = GLsizeiptr(instances.count) * sizeof(glm::mat4);
+	GLintptr offset;
+	float* models = static_cast<float*>(UStreamAllocate(gStream, size, offset));
+	if (!models)
+		return;
+
+	// Workers write disjoint ranges of the mapped memory; binding stays on the GL thread
+	UJobsParallelFor(gJobs, count, INSTANCE_JOB_GRAIN, [&](size_t begin, size_t end, unsigned)
+	{
+		UAnimateInstanceRange(transforms, begin, end, spinZ, spinW, models);
+	});
+	UStateBindBufferRange(gState, GL_SHADER_STORAGE_BUFFER, INSTANCE_BLOCK_BINDING, gStream.buffer, offset, size);
+
+	transforms.reportSeconds += glfwGetTime() - start;
+	++transforms.reportFrames;
+	if (start - transforms.lastReportTime >= STATE_REPORT_INTERVAL)
+	{
+		LOG(LOG_INFO) << "Instances: " << count << " transforms composed in " << 1000.0 * transforms.reportSeconds / transforms.reportFrames << " ms per frame";
+		transforms.reportSeconds = 0.0;
+		transforms.reportFrames = 0;
+		transforms.lastReportTime = start;
+	}
+}
+
+void UAnimateInstanceRange(InstanceTransforms& transforms, size_t begin, size_t end, float spinZ, float spinW, float* models)
+{
+	const glm::vec3 pivot = transforms.scale[0][0] * transforms.pivot;
+	for (size_t i = begin; i < end; ++i)
+	{
+		const float z = transforms.startZ[i] * spinW + transforms.startW[i] * spinZ;
+		const float w = transforms.startW[i] * spinW - transforms.startZ[i] * spinZ;
+		transforms.rotation[2][i] = z;
+		transforms.rotation[3][i] = w;
+
+		// Moving the origin so the pivot stays on the cell center: position = cell - R * S * pivot
+		const float cosAngle = w * w - z * z;
+		const float sinAngle = 2.0f * w * z;
+		transforms.position[0][i] = transforms.cellX[i] - (cosAngle * pivot.x - sinAngle * pivot.y);
+		transforms.position[1][i] = transforms.cellY[i] - (sinAngle * pivot.x + cosAngle * pivot.y);
+	}
+
+	const float* const position[3] = { &transforms.position[0][begin], &transforms.position[1][begin], &transforms.position[2][begin] };
+	const float* const rotation[4] = { &transforms.rotation[0][begin], &transforms.rotation[1][begin], &transforms.rotation[2][begin], &transforms.rotation[3][begin] };
+	const float* const scale[3] = { &transforms.scale[0][begin], &transforms.scale[1][begin], &transforms.scale[2][begin] };
+	glm::composeTRS(end - begin, position, rotation, scale, models + begin * 16);
+}
+
+void UDrawInstances(const GLInstances& instances, GLintptr commandOffset)
+{
+	UStateUseProgram(gState, gInstanceProgram.id);
+	UStateBindVertexArray(gState, instances.vao);
+	glUniform1i(gInstanceTextureLoc, instances.submesh->textureUnit);
+
+	if (gGpuCulling)
+	{
+		// Culling had no command to fill, so there is no survivor list to draw this frame
+		if (commandOffset < 0)
+			return;
+
+		// Instance count was written by the culling pass, the CPU never reads it back
+		UStateBindBuffer(gState, GL_DRAW_INDIRECT_BUFFER, gStream.buffer);
+		glMultiDrawArraysIndirect(GL_TRIANGLES, reinterpret_cast<const void*>(commandOffset), 1, 0);
+	}
+	else
+	{
+		glDrawArraysInstanced(GL_TRIANGLES, instances.submesh->first, instances.submesh->count, instances.count);
+	}
+	++gFrameDrawCalls;
+}
+
+GLintptr UCullInstances(const GLInstances& instances, const glm::mat4& viewProjection)
+{
+	glm::vec4 planes[6];
+	glm::frustumPlanes(viewProjection, planes);
+
+	// Bounding sphere around the submesh's box
+	const GLSubmesh& submesh = *instances.submesh;
+	const glm::vec3 center = 0.5f * (submesh.boundsMin + submesh.boundsMax);
+	const float radius = 0.5f * glm::length(submesh.boundsMax - submesh.boundsMin);
+
+	// A fresh command every frame with the survivor count at zero; count, first and baseInstance never change
+	const DrawArraysIndirectCommand command = { GLuint(submesh.count), 0, GLuint(submesh.first), 0 };
+	GLintptr commandOffset;
+	void* data = UStreamAllocate(gStream, sizeof(command), commandOffset);
+	if (!data)
+		return -1;
+	memcpy(data, &command, sizeof(command));
+	UStateBindBufferRange(gState, GL_SHADER_STORAGE_BUFFER, COMMAND_BLOCK_BINDING, gStream.buffer, commandOffset, sizeof(command));
+
+	UStateUseProgram(gState, gCullProgram.id);
+	glUniform4fv(gCullUniforms.frustumPlanes, 6, glm::value_ptr(planes[0]));
+	glUniform4f(gCullUniforms.boundingSphere, center.x, center.y, center.z, radius);
+	glUniform1ui(gCullUniforms.instanceCount, GLuint(instances.count));
+
+	glDispatchCompute((GLuint(instances.count) + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// The draw reads the command and the visible list as an instanced attribute
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	return commandOffset;
+}
+
+void UTransformBounds(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec3& outMin, glm::vec3& outMax)
+{
+	// Arvo: each matrix element contributes its smaller product to the min and its larger one to the max
+	outMin = outMax = glm::vec3(transform[3]);
+	for (int column = 0; column < 3; ++column)
+	{
+		for (int row = 0; row < 3; ++row)
+		{
+			const float a = transform[column][row] * boundsMin[column];
+			const float b = transform[column][row] * boundsMax[column];
+			outMin[row] += std::min(a, b);
+			outMax[row] += std::max(a, b);
+		}
+	}
+}
+
+void UCullBatchClear(CullBatch& batch, size_t count)
+{
+	batch.minX.clear(); batch.minY.clear(); batch.minZ.clear();
+	batch.maxX.clear(); batch.maxY.clear(); batch.maxZ.clear();
+	batch.minX.reserve(count); batch.minY.reserve(count); batch.minZ.reserve(count);
+	batch.maxX.reserve(count); batch.maxY.reserve(count); batch.maxZ.reserve(count);
+}
+
+void UCullBatchPush(CullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	batch.minX.push_back(boundsMin.x);
+	batch.minY.push_back(boundsMin.y);
+	batch.minZ.push_back(boundsMin.z);
+	batch.maxX.push_back(boundsMax.x);
+	batch.maxY.push_back(boundsMax.y);
+	batch.maxZ.push_back(boundsMax.z);
+}
+
+void UCullBatchTest(CullBatch& batch, const glm::mat4& viewProjection)
+{
+	const size_t count = batch.minX.size();
+	batch.visible.resize(count);
+	if (count == 0)
+		return;
+
+	glm::vec4 planes[6];
+	glm::frustumPlanes(viewProjection, planes);
+	glm::frustumCullAABBs(planes, batch.minX.data(), batch.minY.data(), batch.minZ.data(),
+		batch.maxX.data(), batch.maxY.data(), batch.maxZ.data(), count, batch.visible.data());
+}
+
+uint32_t UTransformAddNode(TransformHierarchy& hierarchy, uint32_t parent, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	// Breadth-first means roots come first and parent indices never decrease, which keeps siblings contiguous
+	const uint32_t node = uint32_t(hierarchy.parent.size());
+	if (node > 0)
+	{
+		const uint32_t lastParent = hierarchy.parent.back();
+		const bool rootAfterChild = parent == NO_PARENT && lastParent != NO_PARENT;
+		const bool parentOutOfOrder = parent != NO_PARENT && lastParent != NO_PARENT && parent < lastParent;
+		if (rootAfterChild || parentOutOfOrder || (parent != NO_PARENT && parent >= node))
+		{
+			LOG(LOG_ERROR) << "Transform node " << node << " is not in breadth-first order";
+			return NO_PARENT;
+		}
+	}
+
+	hierarchy.parent.push_back(parent);
+	hierarchy.firstChild.push_back(0);
+	hierarchy.childCount.push_back(0);
+	hierarchy.position.push_back(position);
+	hierarchy.rotation.push_back(rotation);
+	hierarchy.scale.push_back(scale);
+	hierarchy.world.push_back(glm::mat4(1.0f));
+	hierarchy.dirty.push_back(1);
+	hierarchy.dirtyList.push_back(node);
+
+	if (parent != NO_PARENT)
+	{
+		if (hierarchy.childCount[parent] == 0)
+			hierarchy.firstChild[parent] = node;
+		++hierarchy.childCount[parent];
+	}
+
+	return node;
+}
+
+void UTransformSetLocal(TransformHierarchy& hierarchy, uint32_t node, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	hierarchy.position[node] = position;
+	hierarchy.rotation[node] = rotation;
+	hierarchy.scale[node] = scale;
+	UTransformMarkDirty(hierarchy, node);
+}
+
+void UTransformMarkDirty(TransformHierarchy& hierarchy, uint32_t node)
+{
+	// An already dirty node has its whole subtree queued
+	if (hierarchy.dirty[node])
+		return;
+
+	// The dirty list doubles as the work queue for walking the subtree
+	size_t next = hierarchy.dirtyList.size();
+	hierarchy.dirty[node] = 1;
+	hierarchy.dirtyList.push_back(node);
+	while (next < hierarchy.dirtyList.size())
+	{
+		const uint32_t current = hierarchy.dirtyList[next++];
+		const uint32_t first = hierarchy.firstChild[current];
+		for (uint32_t child = first; child < first + hierarchy.childCount[current]; ++child)
+		{
+			if (!hierarchy.dirty[child])
+			{
+				hierarchy.dirty[child] = 1;
+				hierarchy.dirtyList.push_back(child);
+			}
+		}
+	}
+}
+
+size_t UTransformUpdate(TransformHierarchy& hierarchy)
+{
+	// Index order is breadth-first order, so every parent is current before its children are visited
+	std::sort(hierarchy.dirtyList.begin(), hierarchy.dirtyList.end());
+
+	for (uint32_t node : hierarchy.dirtyList)
+	{
+		const glm::mat4 local = glm::translate(hierarchy.position[node]) * glm::mat4_cast(hierarchy.rotation[node]) * glm::scale(hierarchy.scale[node]);
+		const uint32_t parent = hierarchy.parent[node];
+		hierarchy.world[node] = parent == NO_PARENT ? local : hierarchy.world[parent] * local;
+		hierarchy.dirty[node] = 0;
+	}
+
+	const size_t updated = hierarchy.dirtyList.size();
+	hierarchy.dirtyList.clear();
+	return updated;
+}
+
+void UCreateScene(GLMesh& mesh, TransformHierarchy& hierarchy)
+{
+	const glm::quat noRotation(1.0f, 0.0f, 0.0f, 0.0f);
+
+	// The vertices already place each prop on the table, so the children start at the identity
+	// and the table keeps the scale of 2 the whole scene used to share
+	gTableNode = UTransformAddNode(hierarchy, NO_PARENT, glm::vec3(0.0f), noRotation, glm::vec3(2.0f));
+	gBookNode = UTransformAddNode(hierarchy, gTableNode, glm::vec3(0.0f), noRotation, glm::vec3(1.0f));
+	gCubeNode = UTransformAddNode(hierarchy, gTableNode, glm::vec3(0.0f), noRotation, glm::vec3(1.0f));
+
+	for (GLSubmesh& submesh : mesh.submeshes)
+	{
+		if (strcmp(submesh.name, "book") == 0)
+			submesh.node = gBookNode;
+		else if (strcmp(submesh.name, "rubikscube") == 0)
+			submesh.node = gCubeNode;
+		else
+			submesh.node = gTableNode;
+	}
+
+	UTransformUpdate(hierarchy);
+}
+
+void UTurnCube(const GLMesh& mesh, TransformHierarchy& hierarchy, float degrees)
+{
+	const GLSubmesh* cube = UFindSubmesh(mesh, "rubikscube");
+	if (!cube)
+		return;
+
+	// The cube's vertices sit where it rests on the book, so the turn pivots on its center instead of the
+	// node's origin: rotation * p + position maps the center onto itself
+	const glm::vec3 center = 0.5f * (cube->boundsMin + cube->boundsMax);
+	const glm::quat rotation = glm::angleAxis(glm::radians(degrees), glm::vec3(0.0f, 0.0f, 1.0f));
+	UTransformSetLocal(hierarchy, gCubeNode, center - rotation * center, rotation, glm::vec3(1.0f));
+	gAppliedCubeTurn = degrees;
+}
+
+void UUpdateBatchModels(const GLMesh& mesh, const TransformHierarchy& hierarchy, const GLBatch& batch)
+{
+	std::vector<glm::mat4> models;
+	models.reserve(mesh.submeshes.size());
+	for (const GLSubmesh& submesh : mesh.submeshes)
+		models.push_back(hierarchy.world[submesh.node]);
+
+	// Staging through the stream buffer and copying on the GPU, which orders the copy after draws still
+	// reading the old matrices instead of making the CPU wait for them
+	const GLsizeiptr size = GLsizeiptr(models.size() * sizeof(glm::mat4));
+	GLintptr offset;
+	void* data = UStreamAllocate(gStream, size, offset);
+	if (!data)
+		return;
+	memcpy(data, models.data(), size_t(size));
+	UStateBindBuffer(gState, GL_COPY_READ_BUFFER, gStream.buffer);
+	UStateBindBuffer(gState, GL_COPY_WRITE_BUFFER, batch.modelBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, size);
+}
+
+void UJobsStart(JobSystem& jobs, unsigned workerCount)
+{
+	jobs.body = nullptr;
+	jobs.count = 0;
+	jobs.grain = 1;
+	jobs.next = 0;
+	jobs.pending = 0;
+	jobs.generation = 0;
+	jobs.quit = false;
+
+	// Thread 0 is the calling thread, workers are numbered from 1
+	for (unsigned i = 0; i < workerCount; ++i)
+		jobs.workers.push_back(std::thread(UJobsWorker, &jobs, i + 1));
+}
+
+void UJobsStop(JobSystem& jobs)
+{
+	// Stopping twice, as main's explicit call and its JobsScope both may, does nothing the second time
+	if (jobs.workers.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+		jobs.quit = true;
+	}
+	jobs.wake.notify_all();
+
+	for (std::thread& worker : jobs.workers)
+		worker.join();
+	jobs.workers.clear();
+}
+
+void UJobsParallelFor(JobSystem& jobs, size_t count, size_t grain, const JobBody& body)
+{
+	if (count == 0)
+		return;
+
+	// Not worth waking anyone for a single chunk
+	if (jobs.workers.empty() || count <= grain)
+	{
+		body(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+		jobs.body = &body;
+		jobs.count = count;
+		jobs.grain = grain;
+		jobs.next = 0;
+		jobs.pending = unsigned(jobs.workers.size());
+		++jobs.generation;
+	}
+	jobs.wake.notify_all();
+
+	UJobsRunChunks(jobs, 0);
+
+	std::unique_lock<std::mutex> lock(jobs.mutex);
+	jobs.done.wait(lock, [&jobs] { return jobs.pending == 0; });
+	jobs.body = nullptr;
+}
+
+void UJobsWorker(JobSystem* jobs, unsigned index)
+{
+	UTraceRegisterThread("worker");
+	uint64_t seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(jobs->mutex);
+			jobs->wake.wait(lock, [jobs, seen] { return jobs->quit || jobs->generation != seen; });
+			if (jobs->quit)
+				return;
+			seen = jobs->generation;
+		}
+
+		UJobsRunChunks(*jobs, index);
+
+		{
+			std::lock_guard<std::mutex> lock(jobs->mutex);
+			--jobs->pending;
+		}
+		jobs->done.notify_one();
+	}
+}
+
+void UJobsRunChunks(JobSystem& jobs, unsigned index)
+{
+	for (;;)
+	{
+		const size_t begin = jobs.next.fetch_add(jobs.grain);
+		if (begin >= jobs.count)
+			return;
+		(*jobs.body)(begin, std::min(begin + jobs.grain, jobs.count), index);
+	}
+}
+
+void URecordSubmeshes(CommandList& list, const GLMesh& mesh, size_t begin, size_t end, const glm::mat4& view, const glm::mat4& viewProjection)
+{
+	// Dropping submeshes outside the view before they are recorded
+	UCullBatchClear(list.cull, end - begin);
+	for (size_t i = begin; i < end; ++i)
+	{
+		const GLSubmesh& submesh = mesh.submeshes[i];
+		glm::vec3 worldMin, worldMax;
+		UTransformBounds(gTransforms.world[submesh.node], submesh.boundsMin, submesh.boundsMax, worldMin, worldMax);
+		UCullBatchPush(list.cull, worldMin, worldMax);
+	}
+	UCullBatchTest(list.cull, viewProjection);
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		if (!list.cull.visible[i - begin])
+			continue;
+
+		const GLSubmesh& submesh = mesh.submeshes[i];
+		const glm::mat4& model = gTransforms.world[submesh.node];
+		DrawItem item;
+		item.name = submesh.name;
+		item.program = gProgram.id;
+		item.modelLoc = gObjectUniforms.model;
+		item.textureLoc = gObjectUniforms.uTexture;
+		item.vao = mesh.vao;
+		item.textureUnit = submesh.textureUnit;
+		item.first = submesh.first;
+		item.count = submesh.count;
+		item.model = model;
+
+		// Distance of the bounds center along the view direction
+		const glm::vec3 center = 0.5f * (submesh.boundsMin + submesh.boundsMax);
+		const float depth = -(view * model * glm::vec4(center, 1.0f)).z;
+
+		list.keys.push_back(URenderKey(PASS_OPAQUE, item.program, item.textureUnit, item.vao, depth, 100.0f));
+		list.items.push_back(item);
+	}
+}
+
+bool UMessagePush(MessageQueue& queue, const RenderMessage& message)
+{
+	// Only this thread writes tail; head is read with acquire so the consumer is done with the slot
+	const uint32_t tail = queue.tail.load(std::memory_order_relaxed);
+	if (tail - queue.head.load(std::memory_order_acquire) == MESSAGE_QUEUE_SIZE)
+		return false;
+
+	queue.slots[tail & (MESSAGE_QUEUE_SIZE - 1)] = message;
+	queue.tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+bool UMessagePop(MessageQueue& queue, RenderMessage& message)
+{
+	// Only this thread writes head; tail is read with acquire so the slot's contents are visible
+	const uint32_t head = queue.head.load(std::memory_order_relaxed);
+	if (head == queue.tail.load(std::memory_order_acquire))
+		return false;
+
+	message = queue.slots[head & (MESSAGE_QUEUE_SIZE - 1)];
+	queue.head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+CameraSnapshot UCaptureCamera()
+{
+	CameraSnapshot camera;
+	camera.position = cameraPos;
+	camera.front = cameraFront;
+	camera.up = cameraUp;
+	camera.light = glm::vec3(lX, lY, lZ);
+	camera.perspective = perspective;
+	camera.cubeTurn = cubeTurn;
+	camera.sampleTime = glfwGetTime();
+	camera.inputTime = 0.0;
+	camera.simTime = camera.sampleTime;
+	return camera;
+}
+
+CameraSnapshot UInterpolateCamera(const CameraSnapshot& from, const CameraSnapshot& to, float alpha)
+{
+	CameraSnapshot camera = to;
+	camera.position = glm::mix(from.position, to.position, alpha);
+	camera.front = glm::normalize(glm::mix(from.front, to.front, alpha));
+	camera.up = glm::normalize(glm::mix(from.up, to.up, alpha));
+	camera.light = glm::mix(from.light, to.light, alpha);
+	camera.simTime = from.simTime + (to.simTime - from.simTime) * alpha;
+	return camera;
+}
+
+unsigned URunWindowed(double duration)
+{
+	// Rendering moves to its own thread; this one only handles events and samples input
+	URenderThreadStart();
+
+	deltaTime = float(1.0 / SIM_TICK_RATE);
+	lastFrame = glfwGetTime();
+	double simTime = lastFrame;
+
+	// Recording keeps the state after every tick, so replaying it reproduces mouse and keyboard alike
+	std::ofstream recording;
+	if (gRecordFile)
+	{
+		recording.open(gRecordFile);
+		if (recording)
+		{
+			recording.precision(9);
+			recording << "# time x y z yaw pitch lightX lightY lightZ" << endl;
+			UWriteCameraKey(recording, UCurrentCameraKey(0.0));
+		}
+		else
+			LOG(LOG_ERROR) << "could not open " << gRecordFile << " for recording";
+	}
+	const double recordStart = simTime;
+	double accumulator = 0.0;
+	double lastReportTime = lastFrame;
+	unsigned reportTicks = 0;
+	unsigned totalTicks = 0;
+	while (!glfwWindowShouldClose(gWindow))
+	{
+		const double now = glfwGetTime();
+		if (duration > 0.0 && now - recordStart >= duration)
+			break;
+		accumulator += std::min(now - lastFrame, MAX_SIM_CATCH_UP);
+		lastFrame = now;
+
+		// Advancing the simulation in fixed steps, publishing every tick so the render thread can interpolate
+		while (accumulator >= 1.0 / SIM_TICK_RATE)
+		{
+			UProcessInput(gWindow);
+			simTime += 1.0 / SIM_TICK_RATE;
+			accumulator -= 1.0 / SIM_TICK_RATE;
+			++reportTicks;
+			++totalTicks;
+
+			if (recording.is_open())
+				UWriteCameraKey(recording, UCurrentCameraKey(simTime - recordStart));
+
+			// When the render thread falls far behind the snapshot is dropped; the next one supersedes it anyway
+			RenderMessage message;
+			message.type = MESSAGE_CAMERA;
+			message.camera = UCaptureCamera();
+			message.camera.inputTime = gInput.tickEventTime;
+			message.camera.simTime = simTime;
+			UMessagePush(gMessages, message);
+			if (gIdleRendering)
+				UDamageWake(gDamage);
+		}
+
+		if (gResizePending)
+		{
+			RenderMessage message;
+			message.type = MESSAGE_RESIZE;
+			message.width = gResizeWidth;
+			message.height = gResizeHeight;
+			gResizePending = !UMessagePush(gMessages, message);
+			if (gIdleRendering)
+				UDamageWake(gDamage);
+		}
+
+		if (now - lastReportTime >= STATE_REPORT_INTERVAL)
+		{
+			LOG(LOG_INFO) << "Threads: simulation " << reportTicks / (now - lastReportTime) << " ticks/s, render "
+				<< gRenderFrames.exchange(0) / (now - lastReportTime) << " frames/s";
+			reportTicks = 0;
+			lastReportTime = now;
+		}
+
+		// When the last tick had nothing to apply and nothing is held, ticking on would change nothing:
+		// blocking until an event arrives instead. Animated instances follow the simulation clock, so they keep it running
+		if (gIdleRendering && gStressCount == 0 && !gResizePending && gInput.tickEventTime == 0.0 && UInputIdle(gInput))
+		{
+			glfwWaitEventsTimeout(IDLE_WAIT_SECONDS);
+
+			// The idle stretch is skipped rather than simulated, and the first tick after it runs straight away
+			lastFrame = glfwGetTime();
+			simTime = lastFrame - 1.0 / SIM_TICK_RATE;
+			accumulator = 1.0 / SIM_TICK_RATE;
+			continue;
+		}
+
+		// Handling events as they arrive until the next tick is due
+		const double nextTick = now + (1.0 / SIM_TICK_RATE - accumulator);
+		for (double time = glfwGetTime(); time < nextTick; time = glfwGetTime())
+			glfwWaitEventsTimeout(nextTick - time);
+	}
+
+	URenderThreadStop();
+	return totalTicks;
+}
+
+bool URunTickTest()
+{
+	// Idle mode stops ticking when nothing happens, which is all that happens in a hidden window
+	gIdleRendering = false;
+	if (gRenderDelayMs == 0)
+		gRenderDelayMs = TICK_TEST_RENDER_DELAY_MS;
+
+	const unsigned ticks = URunWindowed(gTickTestSeconds);
+	const double tickRate = ticks / gTickTestSeconds;
+	const double frameRate = gRenderFrameCount / gTickTestSeconds;
+	LOG(LOG_INFO) << "Tick test: " << tickRate << " ticks/s for " << SIM_TICK_RATE << " expected, while rendering "
+		<< frameRate << " frames/s with " << gRenderDelayMs << " ms of delay per frame";
+
+	// Frames as fast as ticks would pass even with input sampled once per frame, proving nothing
+	if (frameRate > 0.5 * SIM_TICK_RATE)
+	{
+		LOG(LOG_ERROR) << "tick test: frames were too fast to slow the simulation down, raise --render-delay";
+		return false;
+	}
+	if (std::abs(tickRate - SIM_TICK_RATE) > TICK_TEST_TOLERANCE * SIM_TICK_RATE)
+	{
+		LOG(LOG_ERROR) << "tick test: input was sampled at " << tickRate << " ticks/s, slow frames held the simulation back";
+		return false;
+	}
+	return true;
+}
+
+bool URunHeadless()
+{
+	if (!UCreateOffscreenTarget(gOffscreen, WINDOW_WIDTH, WINDOW_HEIGHT))
+		return false;
+	glViewport(0, 0, gOffscreen.width, gOffscreen.height);
+
+	// Without input the camera stays where it starts, and the animation advances one simulation tick
+	// per frame, so the same frame number always shows the same image whatever the host's speed
+	gRenderCamera = UCaptureCamera();
+	std::vector<unsigned char> pixels;
+	const double start = glfwGetTime();
+	for (int frame = 0; frame < gHeadlessFrames; ++frame)
+	{
+		gRenderCamera.simTime = frame / SIM_TICK_RATE;
+		URender();
+
+		if (gDumpPrefix)
+		{
+			char filename[512];
+			snprintf(filename, sizeof(filename), "%s%05d.ppm", gDumpPrefix, frame);
+			if (!UWriteFramePPM(filename, gOffscreen.width, gOffscreen.height, pixels))
+				return false;
+		}
+	}
+
+	// Waiting for the last frame so the time covers all the GPU work, not just its submission
+	glFinish();
+	const double seconds = glfwGetTime() - start;
+	LOG(LOG_INFO) << "Headless: " << gHeadlessFrames << " frames of " << gOffscreen.width << "x" << gOffscreen.height << " in " << seconds << " s, "
+		<< 1000.0 * seconds / gHeadlessFrames << " ms per frame" << (gDumpPrefix ? " including writing them to disk" : "");
+
+	UDestroyOffscreenTarget(gOffscreen);
+	return true;
+}
+
+bool UCreateOffscreenTarget(GLOffscreenTarget& target, GLsizei width, GLsizei height)
+{
+	target.width = width;
+	target.height = height;
+
+	glGenRenderbuffers(1, &target.color);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &target.depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	// Left bound for the rest of the run; URender only ever draws to whatever is bound
+	glGenFramebuffers(1, &target.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		LOG(LOG_ERROR) << "offscreen framebuffer is incomplete, status 0x" << std::hex << status << std::dec;
+		UDestroyOffscreenTarget(target);
+		return false;
+	}
+	return true;
+}
+
+void UDestroyOffscreenTarget(GLOffscreenTarget& target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &target.fbo);
+	glDeleteRenderbuffers(1, &target.color);
+	glDeleteRenderbuffers(1, &target.depth);
+	target.fbo = target.color = target.depth = 0;
+}
+
+bool UWriteFramePPM(const char* filename, GLsizei width, GLsizei height, std::vector<unsigned char>& pixels)
+{
+	// Tightly packed RGB rows, flipped because GL reads bottom-up and PPM stores top-down
+	pixels.resize(size_t(width) * height * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	flipImageVertically(pixels.data(), width, height, 3);
+
+	std::ofstream file(filename, std::ios::binary);
+	file << "P6\n" << width << " " << height << "\n255\n";
+	file.write(reinterpret_cast<const char*>(pixels.data()), std::streamsize(pixels.size()));
+	if (!file)
+	{
+		LOG(LOG_ERROR) << "could not write frame to " << filename;
+		return false;
+	}
+	return true;
+}
+
+bool URunBenchmark()
+{
+	std::vector<CameraKey> path;
+	if (gPathFile)
+	{
+		if (!ULoadCameraPath(gPathFile, path))
+			return false;
+	}
+	else
+		UDefaultCameraPath(path);
+
+	// Adding --headless measures offscreen, without presenting
+	const bool offscreen = gHeadlessFrames > 0;
+	if (offscreen)
+	{
+		if (!UCreateOffscreenTarget(gOffscreen, WINDOW_WIDTH, WINDOW_HEIGHT))
+			return false;
+		glViewport(0, 0, gOffscreen.width, gOffscreen.height);
+	}
+
+	std::vector<double> cpuSeconds, swapSeconds;
+	std::vector<unsigned> drawCalls;
+	cpuSeconds.reserve(gBenchmarkFrames);
+	swapSeconds.reserve(gBenchmarkFrames);
+	drawCalls.reserve(gBenchmarkFrames);
+
+	// Uncapped unless --fps asks for a rate; pacing waits are left out of the measured times
+	UPacerStart(gPacer, gTargetFps);
+
+	// Frame N always shows the path at tick N, so runs are comparable whatever the frame rate.
+	// Input callbacks are never installed; the path alone moves the camera and the light
+	const int totalFrames = BENCHMARK_WARMUP_FRAMES + gBenchmarkFrames;
+	for (int frame = 0; frame < totalFrames && !glfwWindowShouldClose(gWindow); ++frame)
+	{
+		const double time = frame / SIM_TICK_RATE;
+		UApplyCameraKey(USampleCameraPath(path, time));
+		gRenderCamera = UCaptureCamera();
+		gRenderCamera.simTime = time;
+
+		const double start = glfwGetTime();
+		URender();
+		const double rendered = glfwGetTime();
+		if (!offscreen)
+		{
+			const unsigned swapScope = UGpuScopeBegin(gGpuProfiler, "swap");
+			glfwSwapBuffers(gWindow);
+			UGpuScopeEnd(gGpuProfiler, swapScope);
+		}
+		const double swapped = glfwGetTime();
+		glfwPollEvents();
+		UPacerWait(gPacer);
+
+		if (frame >= BENCHMARK_WARMUP_FRAMES)
+		{
+			cpuSeconds.push_back(rendered - start);
+			swapSeconds.push_back(swapped - rendered);
+			drawCalls.push_back(gFrameDrawCalls);
+		}
+	}
+
+	if (offscreen)
+		UDestroyOffscreenTarget(gOffscreen);
+
+	if (cpuSeconds.empty())
+	{
+		LOG(LOG_ERROR) << "benchmark stopped before measuring any frame";
+		return false;
+	}
+
+	std::ofstream reportFile;
+	if (gReportFile)
+	{
+		reportFile.open(gReportFile);
+		if (!reportFile)
+		{
+			LOG(LOG_ERROR) << "could not open " << gReportFile << " for the benchmark report";
+			return false;
+		}
+	}
+	// Without a file the report goes to the log as one message, so other output can't land in the middle of it
+	std::ostringstream reportText;
+	std::ostream& report = gReportFile ? static_cast<std::ostream&>(reportFile) : reportText;
+
+	const unsigned minDraws = *std::min_element(drawCalls.begin(), drawCalls.end());
+	const unsigned maxDraws = *std::max_element(drawCalls.begin(), drawCalls.end());
+	double totalDraws = 0.0;
+	for (unsigned draws : drawCalls)
+		totalDraws += draws;
+
+	report << "{" << endl;
+	report << "\t\"frames\": " << cpuSeconds.size() << "," << endl;
+	report << "\t\"warmupFrames\": " << BENCHMARK_WARMUP_FRAMES << "," << endl;
+	report << "\t\"path\": ";
+	UWriteJsonString(report, gPathFile ? gPathFile : "builtin");
+	report << "," << endl;
+	report << "\t\"renderer\": ";
+	UWriteJsonString(report, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+	report << "," << endl;
+	report << "\t\"offscreen\": " << (offscreen ? "true" : "false") << "," << endl;
+	report << "\t\"batched\": " << (gBatchedPath ? "true" : "false") << "," << endl;
+	report << "\t\"stressInstances\": " << gStressCount << "," << endl;
+	report << "\t\"workerThreads\": " << gWorkerCount << "," << endl;
+	report << "\t\"cpuFrameMs\": ";
+	UWriteJsonStats(report, cpuSeconds);
+	report << "," << endl;
+	report << "\t\"swapMs\": ";
+	UWriteJsonStats(report, swapSeconds);
+	report << "," << endl;
+	report << "\t\"drawCalls\": { \"mean\": " << totalDraws / drawCalls.size() << ", \"min\": " << minDraws << ", \"max\": " << maxDraws << " }" << endl;
+	report << "}";
+	if (gReportFile)
+		report << endl;
+	else
+		LOG(LOG_INFO) << reportText.str();
+
+	return true;
+}
+
+bool ULoadCameraPath(const char* filename, std::vector<CameraKey>& path)
+{
+	std::ifstream file(filename);
+	if (!file)
+	{
+		LOG(LOG_ERROR) << "could not open camera path " << filename;
+		return false;
+	}
+
+	path.clear();
+	std::string line;
+	for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+	{
+		const size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+
+		CameraKey key;
+		std::istringstream fields(line);
+		if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch >> key.light.x >> key.light.y >> key.light.z))
+		{
+			LOG(LOG_ERROR) << filename << ":" << lineNumber << ": expected time x y z yaw pitch lightX lightY lightZ";
+			return false;
+		}
+		if (!path.empty() && key.time <= path.back().time)
+		{
+			LOG(LOG_ERROR) << filename << ":" << lineNumber << ": key times must increase";
+			return false;
+		}
+		path.push_back(key);
+	}
+
+	if (path.empty())
+	{
+		LOG(LOG_ERROR) << "camera path " << filename << " has no keys";
+		return false;
+	}
+	return true;
+}
+
+void UDefaultCameraPath(std::vector<CameraKey>& path)
+{
+	// Circling above the table while looking at its center, one lap every 16 seconds
+	const int keyCount = 8;
+	const double lapSeconds = 16.0;
+	const float orbitRadius = 1.5f;
+	const float height = 3.5f;
+
+	path.clear();
+	for (int i = 0; i <= keyCount; ++i)
+	{
+		const float angle = glm::two_pi<float>() * i / keyCount;
+		CameraKey key;
+		key.time = lapSeconds * i / keyCount;
+		key.position = glm::vec3(orbitRadius * std::cos(angle), orbitRadius * std::sin(angle), height);
+
+		// Inverting UUpdateCameraFront for the direction to the origin, keeping yaw continuous between keys
+		const glm::vec3 direction = glm::normalize(-key.position);
+		key.pitch = glm::degrees(std::asin(direction.y));
+		key.yaw = glm::degrees(std::atan2(direction.z, direction.x));
+		if (!path.empty())
+		{
+			while (key.yaw - path.back().yaw > 180.0f)
+				key.yaw -= 360.0f;
+			while (key.yaw - path.back().yaw < -180.0f)
+				key.yaw += 360.0f;
+		}
+
+		// The light sweeps from one side of the table to the other and back
+		key.light = glm::vec3(std::cos(angle), 0.04f, 3.5f);
+		path.push_back(key);
+	}
+}
+
+CameraKey USampleCameraPath(const std::vector<CameraKey>& path, double time)
+{
+	const double duration = path.back().time - path.front().time;
+	if (path.size() < 2 || duration <= 0.0)
+		return path.front();
+
+	time = path.front().time + std::fmod(time, duration);
+
+	// Segment [i, i + 1] holding the time, with its neighbours as the spline's outer control points
+	size_t i = 0;
+	while (i + 2 < path.size() && path[i + 1].time <= time)
+		++i;
+	const CameraKey& k0 = path[i > 0 ? i - 1 : 0];
+	const CameraKey& k1 = path[i];
+	const CameraKey& k2 = path[i + 1];
+	const CameraKey& k3 = path[std::min(i + 2, path.size() - 1)];
+	const float s = float((time - k1.time) / (k2.time - k1.time));
+
+	CameraKey key;
+	key.time = time;
+	key.position = glm::catmullRom(k0.position, k1.position, k2.position, k3.position, s);
+	const glm::vec2 angles = glm::catmullRom(glm::vec2(k0.yaw, k0.pitch), glm::vec2(k1.yaw, k1.pitch), glm::vec2(k2.yaw, k2.pitch), glm::vec2(k3.yaw, k3.pitch), s);
+	key.yaw = angles.x;
+	key.pitch = glm::clamp(angles.y, -89.0f, 89.0f);
+	key.light = glm::catmullRom(k0.light, k1.light, k2.light, k3.light, s);
+	return key;
+}
+
+CameraKey UCurrentCameraKey(double time)
+{
+	CameraKey key;
+	key.time = time;
+	key.position = cameraPos;
+	key.yaw = yaw;
+	key.pitch = pitch;
+	key.light = glm::vec3(lX, lY, lZ);
+	return key;
+}
+
+void UApplyCameraKey(const CameraKey& key)
+{
+	cameraPos = key.position;
+	yaw = key.yaw;
+	pitch = key.pitch;
+	UUpdateCameraFront();
+	lX = key.light.x;
+	lY = key.light.y;
+	lZ = key.light.z;
+}
+
+void UWriteCameraKey(std::ostream& out, const CameraKey& key)
+{
+	out << key.time << " " << key.position.x << " " << key.position.y << " " << key.position.z << " "
+		<< key.yaw << " " << key.pitch << " " << key.light.x << " " << key.light.y << " " << key.light.z << "\n";
+}
+
+double UPercentile(const std::vector<double>& sorted, double p)
+{
+	const size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+	return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+void UWriteJsonStats(std::ostream& out, std::vector<double>& seconds)
+{
+	std::sort(seconds.begin(), seconds.end());
+	double total = 0.0;
+	for (double value : seconds)
+		total += value;
+
+	out << "{ \"mean\": " << 1000.0 * total / seconds.size()
+		<< ", \"p50\": " << 1000.0 * UPercentile(seconds, 50.0)
+		<< ", \"p95\": " << 1000.0 * UPercentile(seconds, 95.0)
+		<< ", \"p99\": " << 1000.0 * UPercentile(seconds, 99.0)
+		<< ", \"max\": " << 1000.0 * seconds.back() << " }";
+}
+
+void UWriteJsonString(std::ostream& out, const char* text)
+{
+	out << '"';
+	for (const char* c = text; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+			out << '\\' << *c;
+		else if (static_cast<unsigned char>(*c) < 0x20)
+			out << ' ';
+		else
+			out << *c;
+	}
+	out << '"';
+}
+
+uint64_t UNowNanoseconds()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void UGpuProfilerCreate(GpuProfiler& profiler)
+{
+	for (GpuQueryFrame& frame : profiler.frames)
+	{
+		glGenQueries(2 * GPU_SCOPES_PER_FRAME, frame.queries);
+		frame.scopeCount = 0;
+	}
+	profiler.frame = 0;
+	profiler.stats.clear();
+	profiler.reportDropped = 0;
+	profiler.lastReportTime = glfwGetTime();
+
+	glGetInteger64v(GL_TIMESTAMP, &profiler.gpuEpoch);
+	profiler.cpuEpoch = UNowNanoseconds();
+}
+
+void UGpuProfilerDestroy(GpuProfiler& profiler)
+{
+	// The last frames are still in flight; waiting is fine now that nothing else is drawn
+	for (unsigned i = 1; i <= GPU_QUERY_FRAMES; ++i)
+	{
+		GpuQueryFrame& frame = profiler.frames[(profiler.frame + i) % GPU_QUERY_FRAMES];
+		UGpuProfilerCollect(profiler, frame, true);
+		glDeleteQueries(2 * GPU_SCOPES_PER_FRAME, frame.queries);
+	}
+	profiler.enabled = false;
+}
+
+void UGpuProfilerBeginFrame(GpuProfiler& profiler)
+{
+	if (!profiler.enabled)
+		return;
+
+	++profiler.frame;
+	GpuQueryFrame& frame = profiler.frames[profiler.frame % GPU_QUERY_FRAMES];
+	if (!UGpuProfilerCollect(profiler, frame, false))
+		++profiler.reportDropped;
+	frame.scopeCount = 0;
+
+	const double now = glfwGetTime();
+	if (now - profiler.lastReportTime >= STATE_REPORT_INTERVAL)
+	{
+		std::ostringstream line;
+		line << "GPU:";
+		for (const GpuScopeStats& scope : profiler.stats)
+		{
+			double total = 0.0, slowest = 0.0;
+			for (unsigned i = 0; i < scope.sampleCount; ++i)
+			{
+				total += scope.samples[i];
+				slowest = std::max(slowest, scope.samples[i]);
+			}
+			line << " " << scope.name << " " << total / std::max(scope.sampleCount, 1u) << " ms (max " << slowest << "),";
+		}
+		line << " " << profiler.reportDropped << " frames not ready in time";
+		LOG(LOG_INFO) << line.str();
+		profiler.reportDropped = 0;
+		profiler.lastReportTime = now;
+	}
+}
+
+bool UGpuProfilerCollect(GpuProfiler& profiler, GpuQueryFrame& frame, bool wait)
+{
+	if (frame.scopeCount == 0)
+		return true;
+
+	// Timestamps complete in order, so the last one being ready means the whole set is
+	if (!wait)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[2 * frame.scopeCount - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			frame.scopeCount = 0;
+			return false;
+		}
+	}
+
+	for (unsigned i = 0; i < frame.scopeCount; ++i)
+	{
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(frame.queries[2 * i], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(frame.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+		const uint64_t duration = end > start ? end - start : 0;
+
+		// Scopes are few, so a linear search by name beats hashing
+		GpuScopeStats* stats = nullptr;
+		for (GpuScopeStats& scope : profiler.stats)
+		{
+			if (strcmp(scope.name, frame.names[i]) == 0)
+			{
+				stats = &scope;
+				break;
+			}
+		}
+		if (!stats)
+		{
+			profiler.stats.push_back(GpuScopeStats());
+			stats = &profiler.stats.back();
+			stats->name = frame.names[i];
+			stats->sampleCount = 0;
+			stats->next = 0;
+		}
+		stats->samples[stats->next] = duration / 1.0e6;
+		stats->next = (stats->next + 1) % GPU_STATS_WINDOW;
+		stats->sampleCount = std::min(stats->sampleCount + 1, GPU_STATS_WINDOW);
+
+		if (gTraceFile && gGpuTraceEvents.size() < TRACE_MAX_EVENTS)
+		{
+			TraceEvent event;
+			event.name = frame.names[i];
+			event.start = uint64_t(GLint64(start) - profiler.gpuEpoch + GLint64(profiler.cpuEpoch));
+			event.duration = duration;
+			event.thread = TRACE_GPU_THREAD;
+			gGpuTraceEvents.push_back(event);
+		}
+	}
+
+	frame.scopeCount = 0;
+	return true;
+}
+
+unsigned UGpuScopeBegin(GpuProfiler& profiler, const char* name)
+{
+	if (!profiler.enabled)
+		return NO_GPU_SCOPE;
+
+	GpuQueryFrame& frame = profiler.frames[profiler.frame % GPU_QUERY_FRAMES];
+	if (frame.scopeCount == GPU_SCOPES_PER_FRAME)
+		return NO_GPU_SCOPE;
+
+	const unsigned scope = frame.scopeCount++;
+	frame.names[scope] = name;
+	glQueryCounter(frame.queries[2 * scope], GL_TIMESTAMP);
+	return scope;
+}
+
+void UGpuScopeEnd(GpuProfiler& profiler, unsigned scope)
+{
+	if (scope == NO_GPU_SCOPE)
+		return;
+
+	GpuQueryFrame& frame = profiler.frames[profiler.frame % GPU_QUERY_FRAMES];
+	glQueryCounter(frame.queries[2 * scope + 1], GL_TIMESTAMP);
+}
+
+bool UWriteChromeTrace(const char* filename)
+{
+	std::ofstream file(filename);
+	if (!file)
+	{
+		LOG(LOG_ERROR) << "could not open " << filename << " for the trace";
+		return false;
+	}
+
+	// Gathering what each ring holds. A ring whose owner keeps writing may wrap under the copy, so its
+	// head is read again afterwards and anything the owner could have overwritten is dropped
+	std::vector<TraceEvent> events(gGpuTraceEvents);
+	std::vector<std::pair<uint32_t, const char*>> threads;
+	const size_t gpuEventCount = events.size();
+	{
+		std::lock_guard<std::mutex> lock(gTraceMutex);
+		for (const std::unique_ptr<TraceRing>& ring : gTraceRings)
+		{
+			threads.push_back(std::make_pair(ring->thread, ring->threadName));
+			const uint64_t head = ring->head.load(std::memory_order_acquire);
+			const uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+			const size_t copied = events.size();
+			for (uint64_t i = first; i < head; ++i)
+			{
+				TraceEvent event = ring->events[i & (TRACE_RING_SIZE - 1)];
+				event.thread = ring->thread;
+				events.push_back(event);
+			}
+
+			// The owner may be writing event `after` right now, into the slot of event after - TRACE_RING_SIZE
+			const uint64_t after = ring->head.load(std::memory_order_acquire);
+			const uint64_t valid = after + 1 > TRACE_RING_SIZE ? after + 1 - TRACE_RING_SIZE : 0;
+			if (valid > first)
+				events.erase(events.begin() + copied, events.begin() + copied + size_t(std::min(valid, head) - first));
+		}
+	}
+
+	// Zones are in clock ticks until now; the ratio comes from the whole run, long enough to be exact
+	double nsPerTick = 1.0;
+#ifdef TRACE_HAS_TSC
+	const uint64_t elapsedTicks = UTraceTicks() - gTraceEpochTicks;
+	const uint64_t elapsedNs = UNowNanoseconds() - gTraceEpochNs;
+	if (elapsedTicks > 0)
+		nsPerTick = double(elapsedNs) / double(elapsedTicks);
+#endif
+	for (size_t i = gpuEventCount; i < events.size(); ++i)
+	{
+		events[i].start = gTraceEpochNs + uint64_t(double(events[i].start - gTraceEpochTicks) * nsPerTick);
+		events[i].duration = uint64_t(double(events[i].duration) * nsPerTick);
+	}
+
+	// Complete ("X") events in microseconds, plus a name for each track
+	file << "{\"traceEvents\":[" << endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << TRACE_GPU_THREAD << ",\"args\":{\"name\":\"GPU\"}}";
+	for (const std::pair<uint32_t, const char*>& thread : threads)
+	{
+		file << "," << endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.first << ",\"args\":{\"name\":";
+		UWriteJsonString(file, thread.second ? thread.second : "thread");
+		file << "}}";
+	}
+	file.precision(3);
+	file << std::fixed;
+	for (const TraceEvent& event : events)
+	{
+		file << "," << endl << "{\"name\":";
+		UWriteJsonString(file, event.name);
+		file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0 << "}";
+	}
+	file << endl << "]}" << endl;
+
+	LOG(LOG_INFO) << "Trace: " << events.size() << " events written to " << filename;
+	return bool(file);
+}
+
+void UTraceStart()
+{
+	gTraceEpochTicks = UTraceTicks();
+	gTraceEpochNs = UNowNanoseconds();
+
+#ifdef SIGUSR1
+	std::signal(SIGUSR1, UTraceSignalHandler);
+#endif
+#ifdef SIGBREAK
+	std::signal(SIGBREAK, UTraceSignalHandler);
+#endif
+}
+
+uint64_t UTraceTicks()
+{
+#ifdef TRACE_HAS_TSC
+	return __rdtsc();
+#else
+	return UNowNanoseconds();
+#endif
+}
+
+void UTraceRecord(const char* name, uint64_t start, uint64_t end)
+{
+	TraceRing* ring = gThreadTraceRing;
+	if (!ring)
+		ring = UTraceRegisterThread(nullptr);
+
+	// Only this thread writes head, so a relaxed load is enough; the release store publishes the event
+	const uint64_t head = ring->head.load(std::memory_order_relaxed);
+	TraceEvent& event = ring->events[head & (TRACE_RING_SIZE - 1)];
+	event.name = name;
+	event.start = start;
+	event.duration = end - start;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+TraceRing* UTraceRegisterThread(const char* name)
+{
+	std::lock_guard<std::mutex> lock(gTraceMutex);
+	if (!gThreadTraceRing)
+	{
+		gTraceRings.push_back(std::unique_ptr<TraceRing>(new TraceRing));
+		gThreadTraceRing = gTraceRings.back().get();
+		gThreadTraceRing->head = 0;
+		// Track 0 is the GPU's
+		gThreadTraceRing->thread = uint32_t(gTraceRings.size());
+		gThreadTraceRing->threadName = nullptr;
+	}
+	if (name)
+		gThreadTraceRing->threadName = name;
+	return gThreadTraceRing;
+}
+
+void UTraceSignalHandler(int signalNumber)
+{
+	gTraceDumpRequested = true;
+	// Some platforms reset the handler once it runs
+	std::signal(signalNumber, UTraceSignalHandler);
+}
+
+void UTraceCheckDumpRequest()
+{
+	if (gTraceDumpRequested.exchange(false))
+		UWriteChromeTrace(gTraceFile ? gTraceFile : DEFAULT_TRACE_FILE);
+}
+
+void ULogStart(const char* filename)
+{
+	if (filename)
+	{
+		gLog.file.open(filename);
+		if (!gLog.file)
+			LOG(LOG_ERROR) << "could not open " << filename << " for logging, using the console";
+	}
+
+	gLog.stub.next = nullptr;
+	gLog.head = &gLog.stub;
+	gLog.tail = &gLog.stub;
+	gLog.quit = false;
+	gLog.writer = std::thread(ULogWriter);
+	gLog.running = true;
+
+	// Covers every way out of main, including early failure returns
+	atexit(ULogStop);
+}
+
+void ULogStop()
+{
+	if (!gLog.running)
+		return;
+
+	gLog.quit = true;
+	gLog.writer.join();
+	gLog.running = false;
+}
+
+void ULogPush(LogLevel level, const std::string& text)
+{
+	if (!gLog.running)
+	{
+		std::string line;
+		ULogFormat(line, level, text);
+		cout << line << flush;
+		return;
+	}
+
+	LogMessage* message = new LogMessage;
+	message->next.store(nullptr, std::memory_order_relaxed);
+	message->level = level;
+	message->text = text;
+
+	// Claiming the head, then linking the previous head to the new message; the writer
+	// treats a message whose next is not linked yet as the end of the queue
+	LogMessage* previous = gLog.head.exchange(message, std::memory_order_acq_rel);
+	previous->next.store(message, std::memory_order_release);
+}
+
+LogMessage* ULogPop(Logger& log)
+{
+	LogMessage* tail = log.tail;
+	LogMessage* next = tail->next.load(std::memory_order_acquire);
+
+	// Stepping over the stub, which only marks the end of the list
+	if (tail == &log.stub)
+	{
+		if (!next)
+			return nullptr;
+		log.tail = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+
+	if (next)
+	{
+		log.tail = next;
+		return tail;
+	}
+
+	// tail is the last linked message. If a push is halfway done, wait for the next wake-up
+	if (tail != log.head.load(std::memory_order_acquire))
+		return nullptr;
+
+	// Putting the stub back behind tail so tail can be handed out without emptying the list
+	log.stub.next.store(nullptr, std::memory_order_relaxed);
+	LogMessage* previous = log.head.exchange(&log.stub, std::memory_order_acq_rel);
+	previous->next.store(&log.stub, std::memory_order_release);
+
+	next = tail->next.load(std::memory_order_acquire);
+	if (next)
+	{
+		log.tail = next;
+		return tail;
+	}
+	return nullptr;
+}
+
+void ULogWriter()
+{
+	std::ostream& out = gLog.file.is_open() ? static_cast<std::ostream&>(gLog.file) : cout;
+	std::string batch;
+	for (;;)
+	{
+		// Checked before draining, so messages pushed before ULogStop still get written
+		const bool quit = gLog.quit;
+
+		while (LogMessage* message = ULogPop(gLog))
+		{
+			ULogFormat(batch, message->level, message->text);
+			delete message;
+		}
+		if (!batch.empty())
+		{
+			out.write(batch.data(), std::streamsize(batch.size()));
+			out.flush();
+			batch.clear();
+		}
+
+		if (quit)
+			return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(LOG_WRITE_INTERVAL_MS));
+	}
+}
+
+void ULogFormat(std::string& out, LogLevel level, const std::string& text)
+{
+	if (level == LOG_DEBUG)
+		out += "DEBUG: ";
+	else if (level == LOG_WARNING)
+		out += "WARNING: ";
+	else if (level == LOG_ERROR)
+		out += "ERROR: ";
+	out += text;
+	out += '\n';
+}
+
+void URenderThreadStart()
+{
+	gMessages.head = 0;
+	gMessages.tail = 0;
+	gRenderQuit = false;
+	gRenderFrames = 0;
+	gRenderFrameCount = 0;
+	gPreviousCamera = gCurrentCamera = gRenderCamera = UCaptureCamera();
+
+	// The context can only be current on one thread at a time
+	glfwMakeContextCurrent(nullptr);
+	gRenderThread = std::thread(URenderThread);
+}
+
+void URenderThreadStop()
+{
+	gRenderQuit = true;
+	UDamageWake(gDamage);
+	gRenderThread.join();
+
+	// Taking the context back so the main thread can release GL objects
+	glfwMakeContextCurrent(gWindow);
+}
+
+void URenderThread()
+{
+	UTraceRegisterThread("render");
+	glfwMakeContextCurrent(gWindow);
+	gLatency.lastReportTime = glfwGetTime();
+	gDamage.firstFrame = true;
+	gDamage.lastReportTime = gLatency.lastReportTime;
+	UPacerStart(gPacer, gTargetFps);
+
+	while (!gRenderQuit)
+	{
+		// Applying everything the main thread sent since the last frame, keeping the two newest ticks
+		// and the oldest input not drawn yet
+		gRenderInputTime = 0.0;
+		RenderMessage message;
+		while (UMessagePop(gMessages, message))
+		{
+			if (message.type == MESSAGE_CAMERA)
+			{
+				gPreviousCamera = gCurrentCamera;
+				gCurrentCamera = message.camera;
+				if (gRenderInputTime == 0.0)
+					gRenderInputTime = message.camera.inputTime;
+			}
+			else if (message.type == MESSAGE_RESIZE)
+			{
+				glViewport(0, 0, message.width, message.height);
+				gDamage.resized = true;
+			}
+		}
+
+		// Drawing one tick behind: the previous tick when the current one was just produced, the current one a tick later
+		const double alpha = (glfwGetTime() - gCurrentCamera.simTime) * SIM_TICK_RATE;
+		gRenderCamera = UInterpolateCamera(gPreviousCamera, gCurrentCamera, float(std::min(std::max(alpha, 0.0), 1.0)));
+
+		if (gIdleRendering)
+		{
+			const unsigned reasons = UDamageCheck(gDamage, float(alpha));
+			UDamageReport(gDamage);
+			if (reasons == 0)
+			{
+				UTraceCheckDumpRequest();
+				UDamageWait(gDamage);
+				UPacerSkip(gPacer);
+				continue;
+			}
+			UDamageRecord(gDamage, reasons);
+		}
+
+		URender();
+
+		// Standing in for a slow frame, for --render-delay and the tick test
+		if (gRenderDelayMs > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(gRenderDelayMs));
+
+		const unsigned swapScope = UGpuScopeBegin(gGpuProfiler, "swap");
+		glfwSwapBuffers(gWindow);
+		UGpuScopeEnd(gGpuProfiler, swapScope);
+		const double swapped = glfwGetTime();
+		++gRenderFrames;
+		++gRenderFrameCount;
+
+		// Fencing before pacing, so the limiter's wait stays out of the measured latency
+		if (gLatencyStats)
+		{
+			if (gRenderInputTime > 0.0)
+				ULatencyFrameDone(gLatency, gRenderInputTime, swapped);
+			ULatencyCollect(gLatency);
+		}
+
+		UPacerWait(gPacer);
+		UPacerRecordFrame(gPacer);
+	}
+
+	ULatencyDestroy(gLatency);
+	glfwMakeContextCurrent(nullptr);
+}
+
+void ULatencyFrameDone(LatencyTracker& latency, double inputTime, double swapTime)
+{
+	latency.toSwap.push_back(swapTime - inputTime);
+	if (latency.pendingCount == LATENCY_MAX_PENDING)
+	{
+		++latency.dropped;
+		return;
+	}
+
+	LatencyFrame& frame = latency.pending[latency.pendingCount++];
+	frame.inputTime = inputTime;
+	frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void ULatencyCollect(LatencyTracker& latency)
+{
+	// Frames finish in order, so polling stops at the first one still running
+	const double now = glfwGetTime();
+	int done = 0;
+	while (done < latency.pendingCount)
+	{
+		LatencyFrame& frame = latency.pending[done];
+		GLint status = GL_UNSIGNALED;
+		glGetSynciv(frame.fence, GL_SYNC_STATUS, 1, nullptr, &status);
+		if (status != GL_SIGNALED)
+			break;
+		latency.toComplete.push_back(now - frame.inputTime);
+		glDeleteSync(frame.fence);
+		++done;
+	}
+	std::copy(latency.pending + done, latency.pending + latency.pendingCount, latency.pending);
+	latency.pendingCount -= done;
+
+	if (now - latency.lastReportTime < STATE_REPORT_INTERVAL)
+		return;
+	if (!latency.toSwap.empty() && !latency.toComplete.empty())
+	{
+		std::sort(latency.toSwap.begin(), latency.toSwap.end());
+		std::sort(latency.toComplete.begin(), latency.toComplete.end());
+		LOG(LOG_INFO) << "Latency: input to swap p50 " << 1000.0 * UPercentile(latency.toSwap, 50.0)
+			<< " ms, p95 " << 1000.0 * UPercentile(latency.toSwap, 95.0) << " ms, max " << 1000.0 * latency.toSwap.back()
+			<< " ms; input to GPU done p50 " << 1000.0 * UPercentile(latency.toComplete, 50.0)
+			<< " ms, p95 " << 1000.0 * UPercentile(latency.toComplete, 95.0) << " ms, max " << 1000.0 * latency.toComplete.back()
+			<< " ms; " << latency.toSwap.size() << " frames with new input, " << latency.dropped << " not fenced"
+			<< (gLateLatch ? ", late latched" : "");
+	}
+	latency.toSwap.clear();
+	latency.toComplete.clear();
+	latency.dropped = 0;
+	latency.lastReportTime = now;
+}
+
+void ULatencyDestroy(LatencyTracker& latency)
+{
+	for (int i = 0; i < latency.pendingCount; ++i)
+		glDeleteSync(latency.pending[i].fence);
+	latency.pendingCount = 0;
+}
+
+void UPublishLatchedLook(double xpos, double ypos, double time)
+{
+	// Cursor offsets add up, so the look after applying every queued event is the last applied look
+	// plus the offset to the newest position. Until the first event is applied there is no reference yet
+	float latchedYaw = yaw, latchedPitch = pitch;
+	if (!firstMouse)
+	{
+		latchedYaw += float(xpos - lastX) * sensitivity;
+		latchedPitch = std::min(std::max(latchedPitch + float(lastY - ypos) * sensitivity, -89.0f), 89.0f);
+	}
+
+	uint32_t bits[2];
+	memcpy(&bits[0], &latchedYaw, sizeof(float));
+	memcpy(&bits[1], &latchedPitch, sizeof(float));
+	gLatchedLook.store(uint64_t(bits[0]) | uint64_t(bits[1]) << 32, std::memory_order_release);
+	gLatchedLookTime.store(time, std::memory_order_release);
+}
+
+bool ULateLatchView(FrameConstants& frame)
+{
+	const double time = gLatchedLookTime.load(std::memory_order_acquire);
+	if (time <= 0.0)
+		return false;
+
+	const uint64_t look = gLatchedLook.load(std::memory_order_acquire);
+	const uint32_t bits[2] = { uint32_t(look), uint32_t(look >> 32) };
+	float latchedYaw, latchedPitch;
+	memcpy(&latchedYaw, &bits[0], sizeof(float));
+	memcpy(&latchedPitch, &bits[1], sizeof(float));
+
+	glm::vec3 front;
+	front.x = cos(glm::radians(latchedYaw)) * cos(glm::radians(latchedPitch));
+	front.y = sin(glm::radians(latchedPitch));
+	front.z = sin(glm::radians(latchedYaw)) * cos(glm::radians(latchedPitch));
+	front = glm::normalize(front);
+
+	// frame lives in write-combined mapped memory: only written, never read back
+	frame.view = glm::lookAt(gRenderCamera.position, gRenderCamera.position + front, gRenderCamera.up);
+
+	// The frame now shows this cursor event, whatever the tick it interpolates
+	if (time != gLastLatchedTime)
+	{
+		gRenderInputTime = time;
+		gLastLatchedTime = time;
+	}
+	return true;
+}
+
+bool UInputIdle(const InputState& input)
+{
+	return input.events.empty() && std::all_of(std::begin(input.actionKeys), std::end(input.actionKeys), [](unsigned char count) { return count == 0; });
+}
+
+unsigned UCameraChanges(const CameraSnapshot& a, const CameraSnapshot& b)
+{
+	unsigned reasons = 0;
+	if (a.position != b.position || a.front != b.front || a.up != b.up)
+		reasons |= 1u << REDRAW_CAMERA;
+	if (a.light != b.light)
+		reasons |= 1u << REDRAW_LIGHT;
+	if (a.perspective != b.perspective)
+		reasons |= 1u << REDRAW_PROJECTION;
+	if (a.cubeTurn != b.cubeTurn)
+		reasons |= 1u << REDRAW_TRANSFORMS;
+	return reasons;
+}
+
+unsigned UDamageCheck(DamageTracker& damage, float alpha)
+{
+	unsigned reasons = 0;
+	if (damage.firstFrame)
+		reasons |= 1u << REDRAW_FIRST_FRAME;
+	if (damage.resized)
+		reasons |= 1u << REDRAW_RESIZE;
+	reasons |= UCameraChanges(gRenderCamera, damage.drawn);
+
+	// Still on the way between two different ticks: the next frames move even if this one happens not to
+	if (alpha < 1.0f)
+		reasons |= UCameraChanges(gPreviousCamera, gCurrentCamera);
+
+	if (gStressCount > 0 && gRenderCamera.simTime != damage.drawn.simTime)
+		reasons |= 1u << REDRAW_ANIMATION;
+	if (!gTransforms.dirtyList.empty())
+		reasons |= 1u << REDRAW_TRANSFORMS;
+	if (gLateLatch && gLatchedLookTime.load(std::memory_order_acquire) != gLastLatchedTime)
+		reasons |= 1u << REDRAW_LATE_LATCH;
+	return reasons;
+}
+
+void UDamageRecord(DamageTracker& damage, unsigned reasons)
+{
+	for (int reason = 0; reason < REDRAW_REASON_COUNT; ++reason)
+	{
+		if (reasons & (1u << reason))
+			++damage.reasonCounts[reason];
+	}
+	++damage.redraws;
+	damage.drawn = gRenderCamera;
+	damage.firstFrame = false;
+	damage.resized = false;
+}
+
+void UDamageWait(DamageTracker& damage)
+{
+	const double start = glfwGetTime();
+	{
+		std::unique_lock<std::mutex> lock(damage.mutex);
+		damage.wake.wait_for(lock, std::chrono::duration<double>(IDLE_WAIT_SECONDS), [&damage] { return damage.wakePending; });
+		damage.wakePending = false;
+	}
+	damage.idleSeconds += glfwGetTime() - start;
+}
+
+void UDamageWake(DamageTracker& damage)
+{
+	{
+		std::lock_guard<std::mutex> lock(damage.mutex);
+		damage.wakePending = true;
+	}
+	damage.wake.notify_one();
+}
+
+void UDamageReport(DamageTracker& damage)
+{
+	const double now = glfwGetTime();
+	if (now - damage.lastReportTime < STATE_REPORT_INTERVAL)
+		return;
+
+	std::ostringstream line;
+	line << "Idle: " << damage.redraws << " redraws (";
+	for (int reason = 0; reason < REDRAW_REASON_COUNT; ++reason)
+		line << (reason > 0 ? ", " : "") << REDRAW_REASON_NAMES[reason] << " " << damage.reasonCounts[reason];
+	line << "), asleep " << 100.0 * damage.idleSeconds / (now - damage.lastReportTime) << "% of the time";
+	LOG(LOG_INFO) << line.str();
+
+	std::fill(std::begin(damage.reasonCounts), std::end(damage.reasonCounts), 0u);
+	damage.redraws = 0;
+	damage.idleSeconds = 0.0;
+	damage.lastReportTime = now;
+}
+
+void USetSwapInterval(SwapMode mode)
+{
+	int interval = 1;
+	if (mode == SWAP_OFF)
+		interval = 0;
+	else if (mode == SWAP_ADAPTIVE)
+	{
+		// A negative interval swaps late frames immediately instead of waiting for the next vertical blank
+		if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+			interval = -1;
+		else
+			LOG(LOG_WARNING) << "adaptive vsync is not supported, using vsync on";
+	}
+	glfwSwapInterval(interval);
+}
+
+void UPacerStart(FramePacer& pacer, double fps)
+{
+	pacer.interval = fps > 0.0 ? 1.0 / fps : 0.0;
+	pacer.deadline = glfwGetTime() + pacer.interval;
+	pacer.spinMargin = LIMITER_MAX_SPIN;
+	pacer.lastFrameTime = 0.0;
+	std::fill(std::begin(pacer.histogram), std::end(pacer.histogram), 0u);
+	pacer.frames = 0;
+	pacer.total = pacer.totalSquares = pacer.slowest = 0.0;
+	pacer.limiterError = 0.0;
+	pacer.limitedFrames = 0;
+	pacer.lastReportTime = glfwGetTime();
+}
+
+void UPacerWait(FramePacer& pacer)
+{
+	if (pacer.interval <= 0.0)
+		return;
+
+	// Sleeping through most of the wait. The scheduler wakes late by an amount that varies, so sleeping
+	// stops spinMargin early, and the margin grows whenever a wake-up was later than that
+	double now = glfwGetTime();
+	const double sleepTime = pacer.deadline - now - pacer.spinMargin;
+	if (sleepTime > 0.0)
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(sleepTime));
+		const double oversleep = glfwGetTime() - (now + sleepTime);
+		pacer.spinMargin = std::min(std::max(pacer.spinMargin * LIMITER_SPIN_DECAY, oversleep), LIMITER_MAX_SPIN);
+		pacer.spinMargin = std::max(pacer.spinMargin, LIMITER_MIN_SPIN);
+	}
+
+	// Spinning the rest of the way, which is exact to the clock's resolution
+	for (now = glfwGetTime(); now < pacer.deadline; now = glfwGetTime())
+		std::this_thread::yield();
+
+	pacer.limiterError += now - pacer.deadline;
+	++pacer.limitedFrames;
+
+	// Deadlines stay on a fixed grid so small errors don't accumulate; a frame that missed a whole
+	// interval restarts the grid rather than letting the next frames rush to catch up
+	pacer.deadline += pacer.interval;
+	if (pacer.deadline < now)
+		pacer.deadline = now + pacer.interval;
+}
+
+void UPacerRecordFrame(FramePacer& pacer)
+{
+	const double now = glfwGetTime();
+	if (pacer.lastFrameTime > 0.0)
+	{
+		const double frameTime = now - pacer.lastFrameTime;
+		++pacer.histogram[std::min(int(frameTime / FRAME_HISTOGRAM_BUCKET), FRAME_HISTOGRAM_BUCKETS - 1)];
+		++pacer.frames;
+		pacer.total += frameTime;
+		pacer.totalSquares += frameTime * frameTime;
+		pacer.slowest = std::max(pacer.slowest, frameTime);
+	}
+	pacer.lastFrameTime = now;
+
+	if (now - pacer.lastReportTime < STATE_REPORT_INTERVAL || pacer.frames == 0)
+		return;
+
+	// Jitter is the standard deviation of the frame time: 0 for perfectly even pacing
+	const double mean = pacer.total / pacer.frames;
+	const double jitter = std::sqrt(std::max(pacer.totalSquares / pacer.frames - mean * mean, 0.0));
+	std::ostringstream line;
+	line << "Pacing: frame time mean " << 1000.0 * mean << " ms, jitter " << 1000.0 * jitter << " ms, max " << 1000.0 * pacer.slowest << " ms";
+	if (pacer.limitedFrames > 0)
+	{
+		line << "; limiter late by " << 1000.0 * pacer.limiterError / pacer.limitedFrames << " ms on average, spinning the last "
+			<< 1000.0 * pacer.spinMargin << " ms";
+	}
+	line << "; histogram";
+	for (int bucket = 0; bucket < FRAME_HISTOGRAM_BUCKETS; ++bucket)
+	{
+		if (pacer.histogram[bucket] < FRAME_HISTOGRAM_MIN_SHARE * pacer.frames)
+			continue;
+		line << " " << 1000.0 * bucket * FRAME_HISTOGRAM_BUCKET;
+		if (bucket + 1 < FRAME_HISTOGRAM_BUCKETS)
+			line << "-" << 1000.0 * (bucket + 1) * FRAME_HISTOGRAM_BUCKET << " ms: ";
+		else
+			line << "+ ms: ";
+		line << pacer.histogram[bucket];
+	}
+	LOG(LOG_INFO) << line.str();
+
+	std::fill(std::begin(pacer.histogram), std::end(pacer.histogram), 0u);
+	pacer.frames = 0;
+	pacer.total = pacer.totalSquares = pacer.slowest = 0.0;
+	pacer.limiterError = 0.0;
+	pacer.limitedFrames = 0;
+	pacer.lastReportTime = now;
+}
+
+void UPacerSkip(FramePacer& pacer)
+{
+	pacer.lastFrameTime = 0.0;
+	pacer.deadline = glfwGetTime();
+}
+
+void USetMeshAttributes(const GLMesh& mesh)
+{
+	const GLint stride = sizeof(float) * 8;
+
+	UStateBindBuffer(gState, GL_ARRAY_BUFFER, mesh.vbo);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 6));
+	glEnableVertexAttribArray(2);
+}
+
+#ifdef _DEBUG
+void UCountDrawnVertices(GLint first, GLsizei count)
+{
+	for (GLint i = first; i < first + count && i < GLint(gVertexDrawCounts.size()); ++i)
+		++gVertexDrawCounts[i];
+}
+
+void UBeginRangeOverlapCheck(const GLMesh& mesh)
+{
+	gVertexDrawCounts.assign(mesh.nIndices, 0);
+
+	if (!gPrimitivesQuery)
+		glGenQueries(1, &gPrimitivesQuery);
+	glBeginQuery(GL_PRIMITIVES_GENERATED, gPrimitivesQuery);
+}
+
+void UEndRangeOverlapCheck()
+{
+	glEndQuery(GL_PRIMITIVES_GENERATED);
+
+	// Vertices submitted more than once mean a range was drawn over another one. Culled ranges are
+	// never submitted, so the triangles expected are those of the ranges drawn this frame, not the whole mesh
+	GLuint resubmitted = 0;
+	GLuint submitted = 0;
+	for (unsigned char count : gVertexDrawCounts)
+	{
+		submitted += count;
+		if (count > 1)
+			resubmitted += count - 1;
+	}
+
+	// Debug builds only, so waiting on the query result is acceptable here
+	GLuint primitives = 0;
+	glGetQueryObjectuiv(gPrimitivesQuery, GL_QUERY_RESULT, &primitives);
+
+	if (resubmitted > 0 || primitives != submitted / 3)
+	{
+		LOG(LOG_WARNING) << "overlapping draw ranges, " << resubmitted << " vertices submitted again, "
+			<< primitives << " triangles generated for " << submitted / 3 << " submitted";
+	}
+}
+#endif
+
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program)
+{
+	TRACE_ZONE("UCreateShaderProgram");
+	const uint64_t start = UNowNanoseconds();
+
+	// A binary cached by an earlier run skips compiling and linking altogether
+	const char* const sources[] = { vtxShaderSource, fragShaderSource };
+	const uint64_t cacheKey = UProgramCacheKey(sources, 2);
+	if (ULoadProgramBinary(cacheKey, program))
+	{
+		UStateUseProgram(gState, program.id);
+		UReflectUniforms(program);
+		++gProgramCacheStats.hits;
+		gProgramCacheStats.nanoseconds += UNowNanoseconds() - start;
+		return true;
+	}
+
+	// for comp and linkage error reporting
+	int success = 0;
+	char infoLog[512];
+
+	// Creating shader program object
+	GLuint programId = glCreateProgram();
+	program.id = programId;
+	if (gShaderCachePrefix)
+		glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	// Creating vertex and fragment shader objects
+	GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+	GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
 
 	// get shader sources
 	glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
@@ -699,7 +4741,7 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
 	if (!success)
 	{
 		glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+		LOG(LOG_ERROR) << "SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog;
 
 		return false;
 	}
@@ -711,7 +4753,7 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
 	if (!success)
 	{
 		glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+		LOG(LOG_ERROR) << "SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog;
 
 		return false;
 	}
@@ -726,24 +4768,396 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
 	if (!success)
 	{
 		glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+		LOG(LOG_ERROR) << "SHADER::PROGRAM::LINKING_FAILED\n" << infoLog;
+
+		return false;
+	}
+
+	USaveProgramBinary(cacheKey, programId);
+
+	UStateUseProgram(gState, programId);
+
+	// Reflecting uniforms now so the render loop never has to ask the driver by name
+	UReflectUniforms(program);
+
+	++gProgramCacheStats.misses;
+	gProgramCacheStats.nanoseconds += UNowNanoseconds() - start;
+	return true;
+}
+
+bool UCreateComputeProgram(const char* computeShaderSource, GLProgram& program)
+{
+	const uint64_t start = UNowNanoseconds();
+	const uint64_t cacheKey = UProgramCacheKey(&computeShaderSource, 1);
+	if (ULoadProgramBinary(cacheKey, program))
+	{
+		UReflectUniforms(program);
+		++gProgramCacheStats.hits;
+		gProgramCacheStats.nanoseconds += UNowNanoseconds() - start;
+		return true;
+	}
+
+	int success = 0;
+	char infoLog[512];
+
+	GLuint programId = glCreateProgram();
+	program.id = programId;
+	if (gShaderCachePrefix)
+		glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	GLuint computeShaderId = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(computeShaderId, 1, &computeShaderSource, NULL);
+
+	glCompileShader(computeShaderId);
+	glGetShaderiv(computeShaderId, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(computeShaderId, sizeof(infoLog), NULL, infoLog);
+		LOG(LOG_ERROR) << "SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog;
+
+		return false;
+	}
+
+	glAttachShader(programId, computeShaderId);
+
+	glLinkProgram(programId);
+	glGetProgramiv(programId, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+		LOG(LOG_ERROR) << "SHADER::PROGRAM::LINKING_FAILED\n" << infoLog;
+
+		return false;
+	}
+
+	// The program keeps the compiled code, the shader object is no longer needed
+	glDetachShader(programId, computeShaderId);
+	glDeleteShader(computeShaderId);
+
+	USaveProgramBinary(cacheKey, programId);
+
+	UReflectUniforms(program);
+
+	++gProgramCacheStats.misses;
+	gProgramCacheStats.nanoseconds += UNowNanoseconds() - start;
+	return true;
+}
+
+uint64_t UProgramCacheKey(const char* const sources[], int sourceCount)
+{
+	// A driver update or another GPU can reject or, worse, misread an old binary, so they change the key too
+	const char* const driver[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+
+	uint64_t hash = 14695981039346656037ull;
+	auto hashString = [&hash](const char* text)
+	{
+		// The terminator goes in as well, so moving text from one string to the next changes the key
+		for (const char* c = text ? text : ""; ; ++c)
+		{
+			hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+			if (*c == '\0')
+				break;
+		}
+	};
+	for (int i = 0; i < sourceCount; ++i)
+		hashString(sources[i]);
+	for (const char* text : driver)
+		hashString(text);
+	return hash;
+}
+
+bool ULoadProgramBinary(uint64_t key, GLProgram& program)
+{
+	if (!gShaderCachePrefix)
+		return false;
+
+	char filename[512];
+	snprintf(filename, sizeof(filename), "%s%016llx.bin", gShaderCachePrefix, (unsigned long long)key);
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	// Checking the header before trusting its length, and the length against what the file holds,
+	// so a corrupt length can't ask for more memory than the file could fill
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) && memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == PROGRAM_CACHE_VERSION && header.key == key)
+	{
+		const std::streamoff binaryStart = file.tellg();
+		file.seekg(0, std::ios::end);
+		const std::streamoff remaining = file.tellg() - binaryStart;
+		file.seekg(binaryStart);
+		if (file && remaining == std::streamoff(header.length))
+		{
+			binary.resize(header.length);
+			file.read(binary.data(), header.length);
+		}
+	}
+	if (!file || binary.empty())
+	{
+		LOG(LOG_WARNING) << filename << " is not a valid program binary, compiling instead";
+		return false;
+	}
+
+	GLuint programId = glCreateProgram();
+	glProgramBinary(programId, GLenum(header.format), binary.data(), GLsizei(header.length));
+	GLint success = 0;
+	glGetProgramiv(programId, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		// Drivers may refuse their own binaries after an update the version string didn't show
+		LOG(LOG_INFO) << "the driver rejected " << filename << ", compiling instead";
+		glDeleteProgram(programId);
+		return false;
+	}
+
+	program.id = programId;
+	return true;
+}
+
+void USaveProgramBinary(uint64_t key, GLuint programId)
+{
+	if (!gShaderCachePrefix)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(programId, length, &length, &format, binary.data());
+	header.format = format;
+	header.length = uint32_t(length);
+
+	char filename[512];
+	snprintf(filename, sizeof(filename), "%s%016llx.bin", gShaderCachePrefix, (unsigned long long)key);
+	std::ofstream file(filename, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(binary.data(), length);
+	if (!file)
+		LOG(LOG_WARNING) << "could not write the program binary cache " << filename;
+}
+
+void UDestroyShaderProgram(GLProgram& program)
+{
+	glDeleteProgram(program.id);
+	program.uniforms.clear();
+	UStateReset(gState);
+}
+
+void UReflectUniforms(GLProgram& program)
+{
+	program.uniforms.clear();
+	program.blocks.clear();
+
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	std::string name(maxLength > 0 ? maxLength : 1, '\0');
+	for (GLint i = 0; i < count; ++i)
+	{
+		GLsizei length = 0;
+		GLUniform uniform;
+		glGetActiveUniform(program.id, GLuint(i), GLsizei(name.size()), &length, &uniform.size, &uniform.type, &name[0]);
+
+		std::string uniformName(name.c_str(), length);
+		uniform.location = glGetUniformLocation(program.id, uniformName.c_str());
+		// Members of uniform blocks have no location and are skipped
+		if (uniform.location < 0)
+			continue;
+
+		// Arrays are reported as "name[0]", store them under their plain name as well
+		const size_t bracket = uniformName.find("[0]");
+		if (bracket != std::string::npos)
+			program.uniforms[uniformName.substr(0, bracket)] = uniform;
+
+		program.uniforms[uniformName] = uniform;
+	}
+
+	GLint blockCount = 0, maxBlockLength = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockLength);
+
+	std::string blockName(maxBlockLength > 0 ? maxBlockLength : 1, '\0');
+	for (GLint i = 0; i < blockCount; ++i)
+	{
+		GLsizei length = 0;
+		GLUniformBlock block;
+		block.index = GLuint(i);
+		glGetActiveUniformBlockName(program.id, block.index, GLsizei(blockName.size()), &length, &blockName[0]);
+		glGetActiveUniformBlockiv(program.id, block.index, GL_UNIFORM_BLOCK_BINDING, &block.binding);
+		glGetActiveUniformBlockiv(program.id, block.index, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+
+		program.blocks[std::string(blockName.c_str(), length)] = block;
+	}
+}
+
+GLint UGetUniform(const GLProgram& program, const char* name, GLenum type)
+{
+	auto it = program.uniforms.find(name);
+	if (it == program.uniforms.end())
+	{
+		LOG(LOG_WARNING) << "uniform " << name << " is not active in program " << program.id;
+		return -1;
+	}
+	if (it->second.type != type)
+	{
+		LOG(LOG_WARNING) << "uniform " << name << " has GL type 0x" << hex << it->second.type << dec << ", expected 0x" << hex << type << dec;
+	}
+	return it->second.location;
+}
+
+bool UCheckUniformBlock(const GLProgram& program, const char* name, GLuint binding, GLint dataSize)
+{
+	auto it = program.blocks.find(name);
+	if (it == program.blocks.end())
+	{
+		LOG(LOG_ERROR) << "uniform block " << name << " is not active in program " << program.id;
+		return false;
+	}
+	if (it->second.binding != GLint(binding) || it->second.dataSize != dataSize)
+	{
+		LOG(LOG_ERROR) << "uniform block " << name << " has binding " << it->second.binding << " and size " << it->second.dataSize
+			<< ", expected binding " << binding << " and size " << dataSize;
+		return false;
+	}
+	return true;
+}
 
+bool UCreateStreamBuffer(StreamBuffer& stream, GLsizeiptr regionSize)
+{
+	// Ranges bound as uniform or storage blocks must start on the stricter of the two alignments
+	GLint uniformAlignment = 0, storageAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+	stream.alignment = std::max(std::max(uniformAlignment, storageAlignment), GLint(sizeof(GLuint)));
+	stream.regionSize = (regionSize + stream.alignment - 1) / stream.alignment * stream.alignment;
+
+	// Mapped once for the lifetime of the buffer; coherent, so writes reach the GPU without explicit flushes
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptr size = stream.regionSize * STREAM_FRAME_COUNT;
+	glGenBuffers(1, &stream.buffer);
+	UStateBindBuffer(gState, GL_COPY_WRITE_BUFFER, stream.buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+	stream.mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+	if (!stream.mapped)
+	{
+		LOG(LOG_ERROR) << "Failed to map the stream buffer";
 		return false;
 	}
 
-	glUseProgram(programId);
+	stream.region = 0;
+	stream.offset = 0;
+	for (unsigned i = 0; i < STREAM_FRAME_COUNT; ++i)
+		stream.fences[i] = nullptr;
+	stream.reportStalls = 0;
+	stream.reportFrames = 0;
+	stream.reportWaitSeconds = 0.0;
+	stream.lastReportTime = glfwGetTime();
 
+	LOG(LOG_INFO) << "Stream buffer: " << STREAM_FRAME_COUNT << " regions of " << stream.regionSize << " bytes";
 	return true;
 }
 
-void UDestroyShaderProgram(GLuint programId)
+void UDestroyStreamBuffer(StreamBuffer& stream)
+{
+	for (unsigned i = 0; i < STREAM_FRAME_COUNT; ++i)
+	{
+		if (stream.fences[i])
+			glDeleteSync(stream.fences[i]);
+		stream.fences[i] = nullptr;
+	}
+
+	UStateBindBuffer(gState, GL_COPY_WRITE_BUFFER, stream.buffer);
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	glDeleteBuffers(1, &stream.buffer);
+	stream.buffer = 0;
+	stream.mapped = nullptr;
+	UStateReset(gState);
+}
+
+void UStreamBeginFrame(StreamBuffer& stream)
+{
+	GLsync& fence = stream.fences[stream.region];
+	if (fence)
+	{
+		// Only blocks when the CPU is a full STREAM_FRAME_COUNT frames ahead of the GPU
+		const double start = glfwGetTime();
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			++stream.reportStalls;
+			do
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			while (result == GL_TIMEOUT_EXPIRED);
+			stream.reportWaitSeconds += glfwGetTime() - start;
+		}
+		if (result == GL_WAIT_FAILED)
+			LOG(LOG_ERROR) << "waiting on the stream buffer fence failed";
+
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	++stream.reportFrames;
+	const double now = glfwGetTime();
+	if (now - stream.lastReportTime >= STATE_REPORT_INTERVAL)
+	{
+		LOG(LOG_INFO) << "Stream buffer: " << stream.reportStalls << " of " << stream.reportFrames << " frames waited on the GPU, "
+			<< 1000.0 * stream.reportWaitSeconds << " ms in total";
+		stream.reportStalls = 0;
+		stream.reportFrames = 0;
+		stream.reportWaitSeconds = 0.0;
+		stream.lastReportTime = now;
+	}
+}
+
+void UStreamEndFrame(StreamBuffer& stream)
+{
+	stream.fences[stream.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	stream.region = (stream.region + 1) % STREAM_FRAME_COUNT;
+	stream.offset = 0;
+}
+
+void* UStreamAllocate(StreamBuffer& stream, GLsizeiptr size, GLintptr& offset)
 {
-	glDeleteProgram(programId);
+	const GLsizeiptr start = (stream.offset + stream.alignment - 1) / stream.alignment * stream.alignment;
+	if (start + size > stream.regionSize)
+	{
+		LOG(LOG_ERROR) << "stream buffer region is out of space for " << size << " bytes";
+		return nullptr;
+	}
+
+	stream.offset = start + size;
+	offset = GLintptr(stream.region) * stream.regionSize + start;
+	return stream.mapped + offset;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
+	InputEvent event;
+	event.type = INPUT_CURSOR;
+	event.time = glfwGetTime();
+	event.key = GLFW_KEY_UNKNOWN;
+	event.pressed = false;
+	event.x = xpos;
+	event.y = ypos;
+	gInput.events.push_back(event);
+
+	if (gLateLatch)
+		UPublishLatchedLook(xpos, ypos, event.time);
+}
 
+void UApplyCursor(double xpos, double ypos)
+{
 	if (firstMouse)
 	{
 		lastX = xpos;
@@ -768,6 +5182,11 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 	if (pitch < -89.0f)
 		pitch = -89.0f;
 
+	UUpdateCameraFront();
+}
+
+void UUpdateCameraFront()
+{
 	glm::vec3 direction;
 	direction.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
 	direction.y = sin(glm::radians(pitch));
@@ -777,6 +5196,8 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
 bool UCreateTexture(const char* filename, GLuint& textureId)
 {
+	TRACE_ZONE("UCreateTexture");
+
 	int width, height, channels;
 	unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
 
@@ -787,7 +5208,7 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
 		// generates texture names
 		glGenTextures(1, &textureId);
 		// binding texure to 2D texture
-		glBindTexture(GL_TEXTURE_2D, textureId);
+		UStateBindTexture(gState, 0, GL_TEXTURE_2D, textureId);
 
 		// set texture wrapping params
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -803,7 +5224,7 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
 		else
 		{
-			cout << "Not implemented to handle image with " << channels << "channels" << endl;
+			LOG(LOG_ERROR) << "Not implemented to handle image with " << channels << "channels";
 			return false;
 		}
 
@@ -813,7 +5234,7 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
 		// free loaded image
 		stbi_image_free(image);
 		// rebinding GL_TEXTURE_2D to nothing
-		glBindTexture(GL_TEXTURE_2D, 0);
+		UStateBindTexture(gState, 0, GL_TEXTURE_2D, 0);
 
 		return true;
 	}
@@ -826,6 +5247,85 @@ void UDestroyTexture(GLuint textureId)
 	glGenTextures(1, &textureId);
 }
 
+bool UCreateTextureArray(const char* const filenames[], GLsizei layerCount, GLsizei layerSize, GLuint& textureId)
+{
+	GLsizei levels = 1;
+	while ((layerSize >> levels) > 0)
+		++levels;
+
+	glGenTextures(1, &textureId);
+	UStateBindTexture(gState, 0, GL_TEXTURE_2D_ARRAY, textureId);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, layerSize, layerSize, layerCount);
+
+	// set texture wrapping and filtering params, matching UCreateTexture
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	std::vector<unsigned char> resampled(size_t(layerSize) * layerSize * 4);
+	for (GLsizei layer = 0; layer < layerCount; ++layer)
+	{
+		// Every layer is stored as RGBA, whatever the source channel count
+		int width, height, channels;
+		unsigned char* image = stbi_load(filenames[layer], &width, &height, &channels, 4);
+		if (!image)
+		{
+			LOG(LOG_ERROR) << "Failed to load texture " << filenames[layer];
+			UStateBindTexture(gState, 0, GL_TEXTURE_2D_ARRAY, 0);
+			glDeleteTextures(1, &textureId);
+			return false;
+		}
+
+		flipImageVertically(image, width, height, 4);
+
+		const unsigned char* pixels = image;
+		if (width != layerSize || height != layerSize)
+		{
+			UResampleImage(image, width, height, resampled.data(), layerSize, layerSize, 4);
+			pixels = resampled.data();
+		}
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, layerSize, layerSize, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+		stbi_image_free(image);
+	}
+
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	UStateBindTexture(gState, 0, GL_TEXTURE_2D_ARRAY, 0);
+
+	return true;
+}
+
+void UResampleImage(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight, int channels)
+{
+	const float scaleX = float(srcWidth) / dstWidth;
+	const float scaleY = float(srcHeight) / dstHeight;
+
+	for (int y = 0; y < dstHeight; ++y)
+	{
+		// Source rows covered by this destination row, at least one
+		const int y0 = std::min(int(y * scaleY), srcHeight - 1);
+		const int y1 = std::max(y0 + 1, std::min(srcHeight, int(std::ceil((y + 1) * scaleY))));
+
+		for (int x = 0; x < dstWidth; ++x)
+		{
+			const int x0 = std::min(int(x * scaleX), srcWidth - 1);
+			const int x1 = std::max(x0 + 1, std::min(srcWidth, int(std::ceil((x + 1) * scaleX))));
+			const int samples = (y1 - y0) * (x1 - x0);
+
+			for (int c = 0; c < channels; ++c)
+			{
+				int sum = 0;
+				for (int sy = y0; sy < y1; ++sy)
+					for (int sx = x0; sx < x1; ++sx)
+						sum += src[(sy * srcWidth + sx) * channels + c];
+
+				dst[(y * dstWidth + x) * channels + c] = (unsigned char)(sum / samples);
+			}
+		}
+	}
+}
+
 void flipImageVertically(unsigned char* image, int width, int height, int channels)
 {
 	for (int j = 0; j < height / 2; ++j)
@@ -842,4 +5342,164 @@ void flipImageVertically(unsigned char* image, int width, int height, int channe
 			++index2;
 		}
 	}
-}
\ No newline at end of file
+}
+
+void UStateReset(GLStateCache& state)
+{
+	state.program = UNKNOWN_BINDING;
+	state.vao = UNKNOWN_BINDING;
+	state.activeUnit = UNKNOWN_BINDING;
+	for (int unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+		for (int target = 0; target < TEXTURE_TARGET_COUNT; ++target)
+			state.textures[unit][target] = UNKNOWN_BINDING;
+	for (int target = 0; target < BUFFER_TARGET_COUNT; ++target)
+		state.buffers[target] = UNKNOWN_BINDING;
+	for (int capability = 0; capability < CAPABILITY_COUNT; ++capability)
+		state.enabled[capability] = -1;
+	state.clearColorKnown = false;
+}
+
+void UStateUseProgram(GLStateCache& state, GLuint program)
+{
+	if (state.program == program)
+	{
+		++state.frameElided;
+		return;
+	}
+	glUseProgram(program);
+	state.program = program;
+	++state.frameIssued;
+}
+
+void UStateBindVertexArray(GLStateCache& state, GLuint vao)
+{
+	if (state.vao == vao)
+	{
+		++state.frameElided;
+		return;
+	}
+	glBindVertexArray(vao);
+	state.vao = vao;
+	++state.frameIssued;
+}
+
+void UStateBindTexture(GLStateCache& state, GLuint unit, GLenum target, GLuint texture)
+{
+	const int index = target == GL_TEXTURE_2D_ARRAY ? TEXTURE_TARGET_2D_ARRAY : TEXTURE_TARGET_2D;
+	if (state.textures[unit][index] == texture)
+	{
+		++state.frameElided;
+		return;
+	}
+	if (state.activeUnit != unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		state.activeUnit = unit;
+		++state.frameIssued;
+	}
+	glBindTexture(target, texture);
+	state.textures[unit][index] = texture;
+	++state.frameIssued;
+}
+
+int UStateBufferIndex(GLenum target)
+{
+	switch (target)
+	{
+	case GL_UNIFORM_BUFFER: return BUFFER_TARGET_UNIFORM;
+	case GL_DRAW_INDIRECT_BUFFER: return BUFFER_TARGET_DRAW_INDIRECT;
+	case GL_SHADER_STORAGE_BUFFER: return BUFFER_TARGET_SHADER_STORAGE;
+	case GL_COPY_READ_BUFFER: return BUFFER_TARGET_COPY_READ;
+	case GL_COPY_WRITE_BUFFER: return BUFFER_TARGET_COPY_WRITE;
+	default: return BUFFER_TARGET_ARRAY;
+	}
+}
+
+void UStateBindBuffer(GLStateCache& state, GLenum target, GLuint buffer)
+{
+	const int index = UStateBufferIndex(target);
+	if (state.buffers[index] == buffer)
+	{
+		++state.frameElided;
+		return;
+	}
+	glBindBuffer(target, buffer);
+	state.buffers[index] = buffer;
+	++state.frameIssued;
+}
+
+void UStateBindBufferBase(GLStateCache& state, GLenum target, GLuint index, GLuint buffer)
+{
+	// Indexed bindings are set once at startup and not shadowed
+	glBindBufferBase(target, index, buffer);
+	state.buffers[UStateBufferIndex(target)] = buffer;
+	++state.frameIssued;
+}
+
+void UStateBindBufferRange(GLStateCache& state, GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	// Ranges move through the stream buffer every frame, so there is nothing to elide
+	glBindBufferRange(target, index, buffer, offset, size);
+	state.buffers[UStateBufferIndex(target)] = buffer;
+	++state.frameIssued;
+}
+
+void UStateSetEnabled(GLStateCache& state, GLenum capability, bool enabled)
+{
+	int index;
+	switch (capability)
+	{
+	case GL_DEPTH_TEST: index = CAPABILITY_DEPTH_TEST; break;
+	case GL_CULL_FACE: index = CAPABILITY_CULL_FACE; break;
+	case GL_BLEND: index = CAPABILITY_BLEND; break;
+	default:
+		// Not shadowed, always forwarded
+		if (enabled) glEnable(capability); else glDisable(capability);
+		++state.frameIssued;
+		return;
+	}
+
+	if (state.enabled[index] == GLint(enabled))
+	{
+		++state.frameElided;
+		return;
+	}
+	if (enabled) glEnable(capability); else glDisable(capability);
+	state.enabled[index] = GLint(enabled);
+	++state.frameIssued;
+}
+
+void UStateClearColor(GLStateCache& state, GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+	const glm::vec4 color(r, g, b, a);
+	if (state.clearColorKnown && state.clearColor == color)
+	{
+		++state.frameElided;
+		return;
+	}
+	glClearColor(r, g, b, a);
+	state.clearColor = color;
+	state.clearColorKnown = true;
+	++state.frameIssued;
+}
+
+void UStateEndFrame(GLStateCache& state)
+{
+	state.reportIssued += state.frameIssued;
+	state.reportElided += state.frameElided;
+	++state.reportFrames;
+	state.frameIssued = 0;
+	state.frameElided = 0;
+
+	const double now = glfwGetTime();
+	if (now - state.lastReportTime >= STATE_REPORT_INTERVAL)
+	{
+		LOG(LOG_INFO) << "GL state: " << double(state.reportIssued) / state.reportFrames << " calls issued, "
+			<< double(state.reportElided) / state.reportFrames << " elided per frame";
+
+		state.reportIssued = 0;
+		state.reportElided = 0;
+		state.reportFrames = 0;
+		state.lastReportTime = now;
+	}
+}
@@ -0,0 +1,91 @@
+/// @ref ext_frustum
+/// @file glm/ext/frustum.hpp
+///
+/// @defgroup ext_frustum GLM_EXT_frustum
+/// @ingroup ext
+///
+/// Extracts the clipping planes of a view frustum and tests bounding volumes against them.
+///
+/// Planes are stored as vec4(normal, distance) with the normal pointing into the frustum,
+/// so a point p lies inside a plane when dot(vec3(plane), p) + plane.w >= 0.
+///
+/// The batch functions take boxes and spheres as structure-of-arrays and test 8 of them
+/// at a time when GLM_ARCH enables AVX, 4 at a time with SSE2, and one at a time otherwise.
+/// Define GLM_FORCE_INTRINSICS to let GLM pick the instruction set the compiler targets.
+///
+/// Include <glm/ext/frustum.hpp> to use the features of this extension.
+///
+/// @see ext_matrix_clip_space
+
+#pragma once
+
+// Dependencies
+#include "../ext/scalar_uint_sized.hpp"
+#include "../geometric.hpp"
+#include "../mat4x4.hpp"
+#include <cstddef>
+
+#if GLM_MESSAGES == GLM_ENABLE && !defined(GLM_EXT_INCLUDED)
+#	pragma message("GLM: GLM_EXT_frustum extension included")
+#endif
+
+namespace glm
+{
+	/// @addtogroup ext_frustum
+	/// @{
+
+	/// Extracts the six normalized planes of the frustum described by a projection * view matrix,
+	/// in the order left, right, bottom, top, near, far. Uses the OpenGL clip volume (-w <= z <= w).
+	///
+	/// @tparam T A floating-point scalar type
+	/// @tparam Q A value from qualifier enum
+	template<typename T, qualifier Q>
+	GLM_FUNC_DECL void frustumPlanes(mat<4, 4, T, Q> const& ProjView, vec<4, T, Q> Planes[6]);
+
+	/// Returns true if the sphere is at least partly inside the frustum.
+	///
+	/// @tparam T A floating-point scalar type
+	/// @tparam Q A value from qualifier enum
+	template<typename T, qualifier Q>
+	GLM_FUNC_DECL bool frustumIntersectsSphere(vec<4, T, Q> const Planes[6], vec<3, T, Q> const& Center, T Radius);
+
+	/// Returns true if the axis-aligned box is at least partly inside the frustum.
+	/// The test is conservative: a box outside the frustum but straddling two planes near a corner may pass.
+	///
+	/// @tparam T A floating-point scalar type
+	/// @tparam Q A value from qualifier enum
+	template<typename T, qualifier Q>
+	GLM_FUNC_DECL bool frustumIntersectsAABB(vec<4, T, Q> const Planes[6], vec<3, T, Q> const& Min, vec<3, T, Q> const& Max);
+
+	/// Tests Count axis-aligned boxes stored as structure-of-arrays against the frustum.
+	/// Writes 1 to Visible[i] when box i passes frustumIntersectsAABB and 0 otherwise.
+	///
+	/// @return The number of visible boxes.
+	GLM_FUNC_DECL std::size_t frustumCullAABBs(vec<4, float, defaultp> const Planes[6],
+		float const* MinX, float const* MinY, float const* MinZ,
+		float const* MaxX, float const* MaxY, float const* MaxZ,
+		std::size_t Count, uint8* Visible);
+
+	/// Tests Count spheres stored as structure-of-arrays against the frustum.
+	/// Writes 1 to Visible[i] when sphere i passes frustumIntersectsSphere and 0 otherwise.
+	///
+	/// @return The number of visible spheres.
+	GLM_FUNC_DECL std::size_t frustumCullSpheres(vec<4, float, defaultp> const Planes[6],
+		float const* CenterX, float const* CenterY, float const* CenterZ, float const* Radius,
+		std::size_t Count, uint8* Visible);
+
+	/// Scalar reference for frustumCullAABBs, one box at a time regardless of GLM_ARCH.
+	GLM_FUNC_DECL std::size_t frustumCullAABBsScalar(vec<4, float, defaultp> const Planes[6],
+		float const* MinX, float const* MinY, float const* MinZ,
+		float const* MaxX, float const* MaxY, float const* MaxZ,
+		std::size_t Count, uint8* Visible);
+
+	/// Scalar reference for frustumCullSpheres, one sphere at a time regardless of GLM_ARCH.
+	GLM_FUNC_DECL std::size_t frustumCullSpheresScalar(vec<4, float, defaultp> const Planes[6],
+		float const* CenterX, float const* CenterY, float const* CenterZ, float const* Radius,
+		std::size_t Count, uint8* Visible);
+
+	/// @}
+}//namespace glm
+
+#include "frustum.inl"
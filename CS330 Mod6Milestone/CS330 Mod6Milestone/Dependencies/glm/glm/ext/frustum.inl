@@ -0,0 +1,207 @@
+/// @ref ext_frustum
+
+namespace glm
+{
+	template<typename T, qualifier Q>
+	GLM_FUNC_QUALIFIER void frustumPlanes(mat<4, 4, T, Q> const& m, vec<4, T, Q> Planes[6])
+	{
+		GLM_STATIC_ASSERT(std::numeric_limits<T>::is_iec559, "'frustumPlanes' only accept floating-point inputs");
+
+		vec<4, T, Q> const Row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		vec<4, T, Q> const Row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		vec<4, T, Q> const Row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		vec<4, T, Q> const Row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Planes[0] = Row3 + Row0;
+		Planes[1] = Row3 - Row0;
+		Planes[2] = Row3 + Row1;
+		Planes[3] = Row3 - Row1;
+		Planes[4] = Row3 + Row2;
+		Planes[5] = Row3 - Row2;
+
+		for(length_t i = 0; i < 6; ++i)
+			Planes[i] /= length(vec<3, T, Q>(Planes[i]));
+	}
+
+	template<typename T, qualifier Q>
+	GLM_FUNC_QUALIFIER bool frustumIntersectsSphere(vec<4, T, Q> const Planes[6], vec<3, T, Q> const& Center, T Radius)
+	{
+		for(length_t i = 0; i < 6; ++i)
+			if(Planes[i].x * Center.x + Planes[i].y * Center.y + Planes[i].z * Center.z + Planes[i].w < -Radius)
+				return false;
+		return true;
+	}
+
+	template<typename T, qualifier Q>
+	GLM_FUNC_QUALIFIER bool frustumIntersectsAABB(vec<4, T, Q> const Planes[6], vec<3, T, Q> const& Min, vec<3, T, Q> const& Max)
+	{
+		// Only the corner furthest along the plane normal needs testing
+		for(length_t i = 0; i < 6; ++i)
+		{
+			T const x = Planes[i].x >= static_cast<T>(0) ? Max.x : Min.x;
+			T const y = Planes[i].y >= static_cast<T>(0) ? Max.y : Min.y;
+			T const z = Planes[i].z >= static_cast<T>(0) ? Max.z : Min.z;
+			if(Planes[i].x * x + Planes[i].y * y + Planes[i].z * z + Planes[i].w < static_cast<T>(0))
+				return false;
+		}
+		return true;
+	}
+
+	GLM_FUNC_QUALIFIER std::size_t frustumCullAABBsScalar(vec<4, float, defaultp> const Planes[6],
+		float const* MinX, float const* MinY, float const* MinZ,
+		float const* MaxX, float const* MaxY, float const* MaxZ,
+		std::size_t Count, uint8* Visible)
+	{
+		std::size_t Result = 0;
+		for(std::size_t i = 0; i < Count; ++i)
+		{
+			bool const Inside = frustumIntersectsAABB(Planes,
+				vec<3, float, defaultp>(MinX[i], MinY[i], MinZ[i]),
+				vec<3, float, defaultp>(MaxX[i], MaxY[i], MaxZ[i]));
+			Visible[i] = Inside ? 1 : 0;
+			Result += Inside ? 1 : 0;
+		}
+		return Result;
+	}
+
+	GLM_FUNC_QUALIFIER std::size_t frustumCullSpheresScalar(vec<4, float, defaultp> const Planes[6],
+		float const* CenterX, float const* CenterY, float const* CenterZ, float const* Radius,
+		std::size_t Count, uint8* Visible)
+	{
+		std::size_t Result = 0;
+		for(std::size_t i = 0; i < Count; ++i)
+		{
+			bool const Inside = frustumIntersectsSphere(Planes,
+				vec<3, float, defaultp>(CenterX[i], CenterY[i], CenterZ[i]), Radius[i]);
+			Visible[i] = Inside ? 1 : 0;
+			Result += Inside ? 1 : 0;
+		}
+		return Result;
+	}
+
+	GLM_FUNC_QUALIFIER std::size_t frustumCullAABBs(vec<4, float, defaultp> const Planes[6],
+		float const* MinX, float const* MinY, float const* MinZ,
+		float const* MaxX, float const* MaxY, float const* MaxZ,
+		std::size_t Count, uint8* Visible)
+	{
+		std::size_t i = 0;
+		std::size_t Result = 0;
+
+#		if GLM_ARCH & GLM_ARCH_SSE2_BIT
+			// The corner to test depends only on the plane, so each plane reads whole lanes from either the min or the max arrays
+			float const* CornerX[6];
+			float const* CornerY[6];
+			float const* CornerZ[6];
+			for(length_t p = 0; p < 6; ++p)
+			{
+				CornerX[p] = Planes[p].x >= 0.0f ? MaxX : MinX;
+				CornerY[p] = Planes[p].y >= 0.0f ? MaxY : MinY;
+				CornerZ[p] = Planes[p].z >= 0.0f ? MaxZ : MinZ;
+			}
+#		endif
+
+#		if GLM_ARCH & GLM_ARCH_AVX_BIT
+			for(; i + 8 <= Count; i += 8)
+			{
+				__m256 Inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for(length_t p = 0; p < 6; ++p)
+				{
+					__m256 const x = _mm256_mul_ps(_mm256_set1_ps(Planes[p].x), _mm256_loadu_ps(CornerX[p] + i));
+					__m256 const y = _mm256_mul_ps(_mm256_set1_ps(Planes[p].y), _mm256_loadu_ps(CornerY[p] + i));
+					__m256 const z = _mm256_mul_ps(_mm256_set1_ps(Planes[p].z), _mm256_loadu_ps(CornerZ[p] + i));
+					__m256 const d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(x, y), z), _mm256_set1_ps(Planes[p].w));
+					Inside = _mm256_and_ps(Inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+				}
+				int const Mask = _mm256_movemask_ps(Inside);
+				for(std::size_t j = 0; j < 8; ++j)
+				{
+					Visible[i + j] = static_cast<uint8>((Mask >> j) & 1);
+					Result += Visible[i + j];
+				}
+			}
+#		endif
+
+#		if GLM_ARCH & GLM_ARCH_SSE2_BIT
+			for(; i + 4 <= Count; i += 4)
+			{
+				__m128 Inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for(length_t p = 0; p < 6; ++p)
+				{
+					__m128 const x = _mm_mul_ps(_mm_set1_ps(Planes[p].x), _mm_loadu_ps(CornerX[p] + i));
+					__m128 const y = _mm_mul_ps(_mm_set1_ps(Planes[p].y), _mm_loadu_ps(CornerY[p] + i));
+					__m128 const z = _mm_mul_ps(_mm_set1_ps(Planes[p].z), _mm_loadu_ps(CornerZ[p] + i));
+					__m128 const d = _mm_add_ps(_mm_add_ps(_mm_add_ps(x, y), z), _mm_set1_ps(Planes[p].w));
+					Inside = _mm_and_ps(Inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+				}
+				int const Mask = _mm_movemask_ps(Inside);
+				for(std::size_t j = 0; j < 4; ++j)
+				{
+					Visible[i + j] = static_cast<uint8>((Mask >> j) & 1);
+					Result += Visible[i + j];
+				}
+			}
+#		endif
+
+		return Result + frustumCullAABBsScalar(Planes, MinX + i, MinY + i, MinZ + i, MaxX + i, MaxY + i, MaxZ + i, Count - i, Visible + i);
+	}
+
+	GLM_FUNC_QUALIFIER std::size_t frustumCullSpheres(vec<4, float, defaultp> const Planes[6],
+		float const* CenterX, float const* CenterY, float const* CenterZ, float const* Radius,
+		std::size_t Count, uint8* Visible)
+	{
+		std::size_t i = 0;
+		std::size_t Result = 0;
+
+#		if GLM_ARCH & GLM_ARCH_AVX_BIT
+			for(; i + 8 <= Count; i += 8)
+			{
+				__m256 const cx = _mm256_loadu_ps(CenterX + i);
+				__m256 const cy = _mm256_loadu_ps(CenterY + i);
+				__m256 const cz = _mm256_loadu_ps(CenterZ + i);
+				__m256 const nr = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(Radius + i));
+				__m256 Inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for(length_t p = 0; p < 6; ++p)
+				{
+					__m256 const x = _mm256_mul_ps(_mm256_set1_ps(Planes[p].x), cx);
+					__m256 const y = _mm256_mul_ps(_mm256_set1_ps(Planes[p].y), cy);
+					__m256 const z = _mm256_mul_ps(_mm256_set1_ps(Planes[p].z), cz);
+					__m256 const d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(x, y), z), _mm256_set1_ps(Planes[p].w));
+					Inside = _mm256_and_ps(Inside, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+				}
+				int const Mask = _mm256_movemask_ps(Inside);
+				for(std::size_t j = 0; j < 8; ++j)
+				{
+					Visible[i + j] = static_cast<uint8>((Mask >> j) & 1);
+					Result += Visible[i + j];
+				}
+			}
+#		endif
+
+#		if GLM_ARCH & GLM_ARCH_SSE2_BIT
+			for(; i + 4 <= Count; i += 4)
+			{
+				__m128 const cx = _mm_loadu_ps(CenterX + i);
+				__m128 const cy = _mm_loadu_ps(CenterY + i);
+				__m128 const cz = _mm_loadu_ps(CenterZ + i);
+				__m128 const nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(Radius + i));
+				__m128 Inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for(length_t p = 0; p < 6; ++p)
+				{
+					__m128 const x = _mm_mul_ps(_mm_set1_ps(Planes[p].x), cx);
+					__m128 const y = _mm_mul_ps(_mm_set1_ps(Planes[p].y), cy);
+					__m128 const z = _mm_mul_ps(_mm_set1_ps(Planes[p].z), cz);
+					__m128 const d = _mm_add_ps(_mm_add_ps(_mm_add_ps(x, y), z), _mm_set1_ps(Planes[p].w));
+					Inside = _mm_and_ps(Inside, _mm_cmpge_ps(d, nr));
+				}
+				int const Mask = _mm_movemask_ps(Inside);
+				for(std::size_t j = 0; j < 4; ++j)
+				{
+					Visible[i + j] = static_cast<uint8>((Mask >> j) & 1);
+					Result += Visible[i + j];
+				}
+			}
+#		endif
+
+		return Result + frustumCullSpheresScalar(Planes, CenterX + i, CenterY + i, CenterZ + i, Radius + i, Count - i, Visible + i);
+	}
+}//namespace glm
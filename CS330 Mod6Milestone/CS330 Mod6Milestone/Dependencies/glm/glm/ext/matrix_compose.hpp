@@ -0,0 +1,56 @@
+/// @ref ext_matrix_compose
+/// @file glm/ext/matrix_compose.hpp
+///
+/// @defgroup ext_matrix_compose GLM_EXT_matrix_compose
+/// @ingroup ext
+///
+/// Builds transformation matrices from a translation, a rotation quaternion and a scale,
+/// equivalent to translate(Translation) * mat4_cast(Rotation) * scale(Scale).
+///
+/// The batch functions take their inputs as structure-of-arrays, one array per component,
+/// and compose 8 matrices at a time when GLM_ARCH enables AVX, 4 at a time with SSE2, and one
+/// at a time otherwise. Results are written as consecutive column-major 4x4 float matrices,
+/// so the destination can be a mapped buffer object.
+///
+/// Include <glm/ext/matrix_compose.hpp> to use the features of this extension.
+///
+/// @see ext_matrix_transform
+/// @see ext_quaternion_transform
+
+#pragma once
+
+// Dependencies
+#include "../ext/quaternion_float.hpp"
+#include "../mat4x4.hpp"
+#include <cstddef>
+
+#if GLM_MESSAGES == GLM_ENABLE && !defined(GLM_EXT_INCLUDED)
+#	pragma message("GLM: GLM_EXT_matrix_compose extension included")
+#endif
+
+namespace glm
+{
+	/// @addtogroup ext_matrix_compose
+	/// @{
+
+	/// Returns translate(Translation) * mat4_cast(Rotation) * scale(Scale). Rotation must be normalized.
+	///
+	/// @tparam T A floating-point scalar type
+	/// @tparam Q A value from qualifier enum
+	template<typename T, qualifier Q>
+	GLM_FUNC_DECL mat<4, 4, T, Q> composeTRS(vec<3, T, Q> const& Translation, qua<T, Q> const& Rotation, vec<3, T, Q> const& Scale);
+
+	/// Composes Count matrices from structure-of-arrays inputs: Translation holds the x, y and z arrays,
+	/// Rotation the x, y, z and w arrays of normalized quaternions, and Scale the x, y and z arrays.
+	/// Writes 16 floats per matrix to Out, column-major.
+	GLM_FUNC_DECL void composeTRS(std::size_t Count,
+		float const* const Translation[3], float const* const Rotation[4], float const* const Scale[3], float* Out);
+
+	/// Scalar reference for the batch composeTRS, one matrix at a time regardless of GLM_ARCH.
+	GLM_FUNC_DECL void composeTRSScalar(std::size_t Count,
+		float const* const Translation[3], float const* const Rotation[4], float const* const Scale[3], float* Out);
+
+	/// @}
+}//namespace glm
+
+#include "matrix_compose.inl"
@@ -0,0 +1,171 @@
+/// @ref ext_matrix_compose
+
+#include "../simd/matrix.h"
+
+namespace glm
+{
+	template<typename T, qualifier Q>
+	GLM_FUNC_QUALIFIER mat<4, 4, T, Q> composeTRS(vec<3, T, Q> const& t, qua<T, Q> const& q, vec<3, T, Q> const& s)
+	{
+		GLM_STATIC_ASSERT(std::numeric_limits<T>::is_iec559, "'composeTRS' only accept floating-point inputs");
+
+		T const x2 = q.x + q.x;
+		T const y2 = q.y + q.y;
+		T const z2 = q.z + q.z;
+		T const xx = q.x * x2;
+		T const yy = q.y * y2;
+		T const zz = q.z * z2;
+		T const xy = q.x * y2;
+		T const xz = q.x * z2;
+		T const yz = q.y * z2;
+		T const wx = q.w * x2;
+		T const wy = q.w * y2;
+		T const wz = q.w * z2;
+
+		mat<4, 4, T, Q> Result;
+		Result[0] = vec<4, T, Q>((static_cast<T>(1) - (yy + zz)) * s.x, (xy + wz) * s.x, (xz - wy) * s.x, static_cast<T>(0));
+		Result[1] = vec<4, T, Q>((xy - wz) * s.y, (static_cast<T>(1) - (xx + zz)) * s.y, (yz + wx) * s.y, static_cast<T>(0));
+		Result[2] = vec<4, T, Q>((xz + wy) * s.z, (yz - wx) * s.z, (static_cast<T>(1) - (xx + yy)) * s.z, static_cast<T>(0));
+		Result[3] = vec<4, T, Q>(t, static_cast<T>(1));
+		return Result;
+	}
+
+	GLM_FUNC_QUALIFIER void composeTRSScalar(std::size_t Count,
+		float const* const Translation[3], float const* const Rotation[4], float const* const Scale[3], float* Out)
+	{
+		for(std::size_t i = 0; i < Count; ++i)
+		{
+			mat<4, 4, float, defaultp> const m = composeTRS(
+				vec<3, float, defaultp>(Translation[0][i], Translation[1][i], Translation[2][i]),
+				qua<float, defaultp>(Rotation[3][i], Rotation[0][i], Rotation[1][i], Rotation[2][i]),
+				vec<3, float, defaultp>(Scale[0][i], Scale[1][i], Scale[2][i]));
+			for(length_t c = 0; c < 4; ++c)
+				for(length_t r = 0; r < 4; ++r)
+					Out[i * 16 + c * 4 + r] = m[c][r];
+		}
+	}
+
+	GLM_FUNC_QUALIFIER void composeTRS(std::size_t Count,
+		float const* const Translation[3], float const* const Rotation[4], float const* const Scale[3], float* Out)
+	{
+		std::size_t i = 0;
+
+#		if GLM_ARCH & GLM_ARCH_AVX_BIT
+			for(; i + 8 <= Count; i += 8)
+			{
+				__m256 const x = _mm256_loadu_ps(Rotation[0] + i);
+				__m256 const y = _mm256_loadu_ps(Rotation[1] + i);
+				__m256 const z = _mm256_loadu_ps(Rotation[2] + i);
+				__m256 const w = _mm256_loadu_ps(Rotation[3] + i);
+				__m256 const sx = _mm256_loadu_ps(Scale[0] + i);
+				__m256 const sy = _mm256_loadu_ps(Scale[1] + i);
+				__m256 const sz = _mm256_loadu_ps(Scale[2] + i);
+				__m256 const one = _mm256_set1_ps(1.0f);
+
+				__m256 const x2 = _mm256_add_ps(x, x);
+				__m256 const y2 = _mm256_add_ps(y, y);
+				__m256 const z2 = _mm256_add_ps(z, z);
+				__m256 const xx = _mm256_mul_ps(x, x2);
+				__m256 const yy = _mm256_mul_ps(y, y2);
+				__m256 const zz = _mm256_mul_ps(z, z2);
+				__m256 const xy = _mm256_mul_ps(x, y2);
+				__m256 const xz = _mm256_mul_ps(x, z2);
+				__m256 const yz = _mm256_mul_ps(y, z2);
+				__m256 const wx = _mm256_mul_ps(w, x2);
+				__m256 const wy = _mm256_mul_ps(w, y2);
+				__m256 const wz = _mm256_mul_ps(w, z2);
+
+				// Row r of column c for all 8 matrices; the w row is constant
+				__m256 Columns[4][3];
+				Columns[0][0] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx);
+				Columns[0][1] = _mm256_mul_ps(_mm256_add_ps(xy, wz), sx);
+				Columns[0][2] = _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx);
+				Columns[1][0] = _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy);
+				Columns[1][1] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy);
+				Columns[1][2] = _mm256_mul_ps(_mm256_add_ps(yz, wx), sy);
+				Columns[2][0] = _mm256_mul_ps(_mm256_add_ps(xz, wy), sz);
+				Columns[2][1] = _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz);
+				Columns[2][2] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz);
+				Columns[3][0] = _mm256_loadu_ps(Translation[0] + i);
+				Columns[3][1] = _mm256_loadu_ps(Translation[1] + i);
+				Columns[3][2] = _mm256_loadu_ps(Translation[2] + i);
+
+				// Transposing each half turns 4 matrices' worth of one column into 4 stored columns
+				for(length_t c = 0; c < 4; ++c)
+				{
+					glm_vec4 const w4 = c == 3 ? _mm_set1_ps(1.0f) : _mm_setzero_ps();
+					glm_vec4 const Low[4] = {_mm256_castps256_ps128(Columns[c][0]), _mm256_castps256_ps128(Columns[c][1]), _mm256_castps256_ps128(Columns[c][2]), w4};
+					glm_vec4 const High[4] = {_mm256_extractf128_ps(Columns[c][0], 1), _mm256_extractf128_ps(Columns[c][1], 1), _mm256_extractf128_ps(Columns[c][2], 1), w4};
+					glm_vec4 LowOut[4], HighOut[4];
+					glm_mat4_transpose(Low, LowOut);
+					glm_mat4_transpose(High, HighOut);
+					for(std::size_t k = 0; k < 4; ++k)
+					{
+						_mm_storeu_ps(Out + (i + k) * 16 + c * 4, LowOut[k]);
+						_mm_storeu_ps(Out + (i + k + 4) * 16 + c * 4, HighOut[k]);
+					}
+				}
+			}
+#		endif
+
+#		if GLM_ARCH & GLM_ARCH_SSE2_BIT
+			for(; i + 4 <= Count; i += 4)
+			{
+				glm_vec4 const x = _mm_loadu_ps(Rotation[0] + i);
+				glm_vec4 const y = _mm_loadu_ps(Rotation[1] + i);
+				glm_vec4 const z = _mm_loadu_ps(Rotation[2] + i);
+				glm_vec4 const w = _mm_loadu_ps(Rotation[3] + i);
+				glm_vec4 const sx = _mm_loadu_ps(Scale[0] + i);
+				glm_vec4 const sy = _mm_loadu_ps(Scale[1] + i);
+				glm_vec4 const sz = _mm_loadu_ps(Scale[2] + i);
+				glm_vec4 const one = _mm_set1_ps(1.0f);
+
+				glm_vec4 const x2 = glm_vec4_add(x, x);
+				glm_vec4 const y2 = glm_vec4_add(y, y);
+				glm_vec4 const z2 = glm_vec4_add(z, z);
+				glm_vec4 const xx = glm_vec4_mul(x, x2);
+				glm_vec4 const yy = glm_vec4_mul(y, y2);
+				glm_vec4 const zz = glm_vec4_mul(z, z2);
+				glm_vec4 const xy = glm_vec4_mul(x, y2);
+				glm_vec4 const xz = glm_vec4_mul(x, z2);
+				glm_vec4 const yz = glm_vec4_mul(y, z2);
+				glm_vec4 const wx = glm_vec4_mul(w, x2);
+				glm_vec4 const wy = glm_vec4_mul(w, y2);
+				glm_vec4 const wz = glm_vec4_mul(w, z2);
+
+				// Row r of column c for all 4 matrices, with the constant w row last
+				glm_vec4 Columns[4][4];
+				Columns[0][0] = glm_vec4_mul(glm_vec4_sub(one, glm_vec4_add(yy, zz)), sx);
+				Columns[0][1] = glm_vec4_mul(glm_vec4_add(xy, wz), sx);
+				Columns[0][2] = glm_vec4_mul(glm_vec4_sub(xz, wy), sx);
+				Columns[0][3] = _mm_setzero_ps();
+				Columns[1][0] = glm_vec4_mul(glm_vec4_sub(xy, wz), sy);
+				Columns[1][1] = glm_vec4_mul(glm_vec4_sub(one, glm_vec4_add(xx, zz)), sy);
+				Columns[1][2] = glm_vec4_mul(glm_vec4_add(yz, wx), sy);
+				Columns[1][3] = _mm_setzero_ps();
+				Columns[2][0] = glm_vec4_mul(glm_vec4_add(xz, wy), sz);
+				Columns[2][1] = glm_vec4_mul(glm_vec4_sub(yz, wx), sz);
+				Columns[2][2] = glm_vec4_mul(glm_vec4_sub(one, glm_vec4_add(xx, yy)), sz);
+				Columns[2][3] = _mm_setzero_ps();
+				Columns[3][0] = _mm_loadu_ps(Translation[0] + i);
+				Columns[3][1] = _mm_loadu_ps(Translation[1] + i);
+				Columns[3][2] = _mm_loadu_ps(Translation[2] + i);
+				Columns[3][3] = one;
+
+				// Transposing turns 4 matrices' worth of one column into 4 stored columns
+				for(length_t c = 0; c < 4; ++c)
+				{
+					glm_vec4 Stored[4];
+					glm_mat4_transpose(Columns[c], Stored);
+					for(std::size_t k = 0; k < 4; ++k)
+						_mm_storeu_ps(Out + (i + k) * 16 + c * 4, Stored[k]);
+				}
+			}
+#		endif
+
+		float const* const TailTranslation[3] = {Translation[0] + i, Translation[1] + i, Translation[2] + i};
+		float const* const TailRotation[4] = {Rotation[0] + i, Rotation[1] + i, Rotation[2] + i, Rotation[3] + i};
+		float const* const TailScale[3] = {Scale[0] + i, Scale[1] + i, Scale[2] + i};
+		composeTRSScalar(Count - i, TailTranslation, TailRotation, TailScale, Out + i * 16);
+	}
+}//namespace glm
@@ -0,0 +1,111 @@
+#ifndef GLM_FORCE_INTRINSICS
+#	define GLM_FORCE_INTRINSICS
+#endif
+#include <glm/ext/frustum.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/ext/vector_relational.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <glm/ext/vector_float4.hpp>
+#include <cstdlib>
+#include <vector>
+
+static int test_frustumPlanes()
+{
+	int Error = 0;
+
+	// An orthographic unit cube has axis aligned planes at distance 1
+	glm::vec4 Planes[6];
+	glm::frustumPlanes(glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f), Planes);
+
+	Error += glm::all(glm::equal(Planes[0], glm::vec4(1, 0, 0, 1), glm::epsilon<float>())) ? 0 : 1;
+	Error += glm::all(glm::equal(Planes[1], glm::vec4(-1, 0, 0, 1), glm::epsilon<float>())) ? 0 : 1;
+	Error += glm::all(glm::equal(Planes[2], glm::vec4(0, 1, 0, 1), glm::epsilon<float>())) ? 0 : 1;
+	Error += glm::all(glm::equal(Planes[3], glm::vec4(0, -1, 0, 1), glm::epsilon<float>())) ? 0 : 1;
+
+	// Perspective near and far planes face each other along -z
+	glm::frustumPlanes(glm::perspective(glm::radians(90.0f), 1.0f, 0.5f, 10.0f), Planes);
+	Error += glm::all(glm::equal(Planes[4], glm::vec4(0, 0, -1, -0.5f), 0.0001f)) ? 0 : 1;
+	Error += glm::all(glm::equal(Planes[5], glm::vec4(0, 0, 1, 10.0f), 0.0001f)) ? 0 : 1;
+
+	return Error;
+}
+
+static int test_frustumIntersects()
+{
+	int Error = 0;
+
+	glm::mat4 const ProjView = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f) *
+		glm::lookAt(glm::vec3(0, 0, 5), glm::vec3(0), glm::vec3(0, 1, 0));
+	glm::vec4 Planes[6];
+	glm::frustumPlanes(ProjView, Planes);
+
+	Error += glm::frustumIntersectsSphere(Planes, glm::vec3(0), 1.0f) ? 0 : 1;
+	Error += !glm::frustumIntersectsSphere(Planes, glm::vec3(0, 0, 10), 1.0f) ? 0 : 1;
+	Error += !glm::frustumIntersectsSphere(Planes, glm::vec3(50, 0, 0), 1.0f) ? 0 : 1;
+	Error += glm::frustumIntersectsSphere(Planes, glm::vec3(0, 0, 10), 6.0f) ? 0 : 1;
+
+	Error += glm::frustumIntersectsAABB(Planes, glm::vec3(-1), glm::vec3(1)) ? 0 : 1;
+	Error += !glm::frustumIntersectsAABB(Planes, glm::vec3(49), glm::vec3(51)) ? 0 : 1;
+	Error += !glm::frustumIntersectsAABB(Planes, glm::vec3(-1, -1, 6), glm::vec3(1, 1, 8)) ? 0 : 1;
+	Error += glm::frustumIntersectsAABB(Planes, glm::vec3(-100, -1, -1), glm::vec3(100, 1, 1)) ? 0 : 1;
+
+	return Error;
+}
+
+static float random_float(float Min, float Max)
+{
+	return Min + (Max - Min) * static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX);
+}
+
+static int test_frustumCull()
+{
+	int Error = 0;
+
+	glm::mat4 const ProjView = glm::perspective(glm::radians(45.0f), 1.5f, 0.1f, 50.0f) *
+		glm::lookAt(glm::vec3(3, 4, 5), glm::vec3(0), glm::vec3(0, 1, 0));
+	glm::vec4 Planes[6];
+	glm::frustumPlanes(ProjView, Planes);
+
+	// An odd count exercises the scalar tail after the SIMD lanes
+	std::size_t const Count = 1003;
+	std::vector<float> MinX(Count), MinY(Count), MinZ(Count), MaxX(Count), MaxY(Count), MaxZ(Count), Radius(Count);
+	for(std::size_t i = 0; i < Count; ++i)
+	{
+		MinX[i] = random_float(-40.0f, 40.0f);
+		MinY[i] = random_float(-40.0f, 40.0f);
+		MinZ[i] = random_float(-40.0f, 40.0f);
+		MaxX[i] = MinX[i] + random_float(0.0f, 4.0f);
+		MaxY[i] = MinY[i] + random_float(0.0f, 4.0f);
+		MaxZ[i] = MinZ[i] + random_float(0.0f, 4.0f);
+		Radius[i] = random_float(0.0f, 4.0f);
+	}
+
+	std::vector<glm::uint8> Batch(Count), Scalar(Count);
+
+	std::size_t const BatchBoxes = glm::frustumCullAABBs(Planes, &MinX[0], &MinY[0], &MinZ[0], &MaxX[0], &MaxY[0], &MaxZ[0], Count, &Batch[0]);
+	std::size_t const ScalarBoxes = glm::frustumCullAABBsScalar(Planes, &MinX[0], &MinY[0], &MinZ[0], &MaxX[0], &MaxY[0], &MaxZ[0], Count, &Scalar[0]);
+	Error += BatchBoxes == ScalarBoxes ? 0 : 1;
+	Error += BatchBoxes > 0 && BatchBoxes < Count ? 0 : 1;
+	Error += Batch == Scalar ? 0 : 1;
+
+	std::size_t const BatchSpheres = glm::frustumCullSpheres(Planes, &MinX[0], &MinY[0], &MinZ[0], &Radius[0], Count, &Batch[0]);
+	std::size_t const ScalarSpheres = glm::frustumCullSpheresScalar(Planes, &MinX[0], &MinY[0], &MinZ[0], &Radius[0], Count, &Scalar[0]);
+	Error += BatchSpheres == ScalarSpheres ? 0 : 1;
+	Error += BatchSpheres > 0 && BatchSpheres < Count ? 0 : 1;
+	Error += Batch == Scalar ? 0 : 1;
+
+	return Error;
+}
+
+int main()
+{
+	int Error = 0;
+
+	Error += test_frustumPlanes();
+	Error += test_frustumIntersects();
+	Error += test_frustumCull();
+
+	return Error;
+}
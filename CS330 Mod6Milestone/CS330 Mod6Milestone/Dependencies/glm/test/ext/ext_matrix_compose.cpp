@@ -0,0 +1,87 @@
+#ifndef GLM_FORCE_INTRINSICS
+#	define GLM_FORCE_INTRINSICS
+#endif
+#include <glm/ext/matrix_compose.hpp>
+#include <glm/ext/matrix_relational.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/quaternion_trigonometric.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <cstdlib>
+#include <vector>
+
+static int test_composeTRS()
+{
+	int Error = 0;
+
+	glm::vec3 const T(1.0f, -2.0f, 3.0f);
+	glm::quat const R = glm::angleAxis(0.7f, glm::normalize(glm::vec3(1.0f, 2.0f, 3.0f)));
+	glm::vec3 const S(2.0f, 0.5f, 3.0f);
+
+	glm::mat4 const Expected = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), T), glm::angle(R), glm::axis(R)), S);
+	Error += glm::all(glm::equal(glm::composeTRS(T, R, S), Expected, 0.0001f)) ? 0 : 1;
+	Error += glm::all(glm::equal(glm::composeTRS(T, R, S), glm::translate(glm::mat4(1.0f), T) * glm::mat4_cast(R) * glm::scale(glm::mat4(1.0f), S), 0.0001f)) ? 0 : 1;
+
+	return Error;
+}
+
+static float random_float(float Min, float Max)
+{
+	return Min + (Max - Min) * static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX);
+}
+
+static int test_composeTRS_batch()
+{
+	int Error = 0;
+
+	// An odd count exercises the scalar tail after the SIMD lanes
+	std::size_t const Count = 1003;
+	std::vector<float> Components[10];
+	for(std::size_t c = 0; c < 10; ++c)
+		Components[c].resize(Count);
+	for(std::size_t i = 0; i < Count; ++i)
+	{
+		glm::quat const R = glm::angleAxis(random_float(-3.0f, 3.0f), glm::normalize(glm::vec3(random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f), 1.0f)));
+		Components[0][i] = random_float(-10.0f, 10.0f);
+		Components[1][i] = random_float(-10.0f, 10.0f);
+		Components[2][i] = random_float(-10.0f, 10.0f);
+		Components[3][i] = R.x;
+		Components[4][i] = R.y;
+		Components[5][i] = R.z;
+		Components[6][i] = R.w;
+		Components[7][i] = random_float(0.1f, 4.0f);
+		Components[8][i] = random_float(0.1f, 4.0f);
+		Components[9][i] = random_float(0.1f, 4.0f);
+	}
+
+	float const* const Translation[3] = {&Components[0][0], &Components[1][0], &Components[2][0]};
+	float const* const Rotation[4] = {&Components[3][0], &Components[4][0], &Components[5][0], &Components[6][0]};
+	float const* const Scale[3] = {&Components[7][0], &Components[8][0], &Components[9][0]};
+
+	std::vector<glm::mat4> Batch(Count), Scalar(Count);
+	glm::composeTRS(Count, Translation, Rotation, Scale, &Batch[0][0][0]);
+	glm::composeTRSScalar(Count, Translation, Rotation, Scale, &Scalar[0][0][0]);
+
+	for(std::size_t i = 0; i < Count; ++i)
+	{
+		Error += glm::all(glm::equal(Batch[i], Scalar[i], 0.0001f)) ? 0 : 1;
+
+		glm::mat4 const Expected = glm::composeTRS(
+			glm::vec3(Translation[0][i], Translation[1][i], Translation[2][i]),
+			glm::quat(Rotation[3][i], Rotation[0][i], Rotation[1][i], Rotation[2][i]),
+			glm::vec3(Scale[0][i], Scale[1][i], Scale[2][i]));
+		Error += glm::all(glm::equal(Scalar[i], Expected, 0.0001f)) ? 0 : 1;
+	}
+
+	return Error;
+}
+
+int main()
+{
+	int Error = 0;
+
+	Error += test_composeTRS();
+	Error += test_composeTRS_batch();
+
+	return Error;
+}
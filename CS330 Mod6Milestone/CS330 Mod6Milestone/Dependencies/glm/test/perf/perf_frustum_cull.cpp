@@ -0,0 +1,90 @@
+#ifndef GLM_FORCE_INTRINSICS
+#	define GLM_FORCE_INTRINSICS
+#endif
+#include <glm/ext/frustum.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <glm/ext/vector_float4.hpp>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+
+struct soa_boxes
+{
+	std::vector<float> MinX, MinY, MinZ, MaxX, MaxY, MaxZ;
+};
+
+static float random_float(float Min, float Max)
+{
+	return Min + (Max - Min) * static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX);
+}
+
+static void init_boxes(soa_boxes& Boxes, std::size_t Count)
+{
+	Boxes.MinX.resize(Count); Boxes.MinY.resize(Count); Boxes.MinZ.resize(Count);
+	Boxes.MaxX.resize(Count); Boxes.MaxY.resize(Count); Boxes.MaxZ.resize(Count);
+	for(std::size_t i = 0; i < Count; ++i)
+	{
+		Boxes.MinX[i] = random_float(-50.0f, 50.0f);
+		Boxes.MinY[i] = random_float(-50.0f, 50.0f);
+		Boxes.MinZ[i] = random_float(-50.0f, 50.0f);
+		Boxes.MaxX[i] = Boxes.MinX[i] + random_float(0.0f, 2.0f);
+		Boxes.MaxY[i] = Boxes.MinY[i] + random_float(0.0f, 2.0f);
+		Boxes.MaxZ[i] = Boxes.MinZ[i] + random_float(0.0f, 2.0f);
+	}
+}
+
+typedef std::size_t (*cull_func)(glm::vec4 const*, float const*, float const*, float const*, float const*, float const*, float const*, std::size_t, glm::uint8*);
+
+static double launch_cull(cull_func Func, glm::vec4 const Planes[6], soa_boxes const& Boxes, std::vector<glm::uint8>& Visible, std::size_t Iterations, std::size_t& VisibleCount)
+{
+	std::size_t const Count = Visible.size();
+
+	std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+	for(std::size_t i = 0; i < Iterations; ++i)
+		VisibleCount = Func(Planes, &Boxes.MinX[0], &Boxes.MinY[0], &Boxes.MinZ[0], &Boxes.MaxX[0], &Boxes.MaxY[0], &Boxes.MaxZ[0], Count, &Visible[0]);
+	std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+
+	double const Seconds = std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count();
+	return static_cast<double>(Count * Iterations) / Seconds;
+}
+
+int main()
+{
+	std::size_t const Count = 100000;
+	std::size_t const Iterations = 100;
+
+	int Error = 0;
+
+	glm::vec4 Planes[6];
+	glm::frustumPlanes(glm::perspective(glm::radians(45.0f), 1.5f, 0.1f, 100.0f) *
+		glm::lookAt(glm::vec3(0, 10, 40), glm::vec3(0), glm::vec3(0, 1, 0)), Planes);
+
+	soa_boxes Boxes;
+	init_boxes(Boxes, Count);
+
+	std::vector<glm::uint8> ScalarVisible(Count), BatchVisible(Count);
+	std::size_t ScalarCount = 0, BatchCount = 0;
+
+	double const ScalarRate = launch_cull(glm::frustumCullAABBsScalar, Planes, Boxes, ScalarVisible, Iterations, ScalarCount);
+	double const BatchRate = launch_cull(glm::frustumCullAABBs, Planes, Boxes, BatchVisible, Iterations, BatchCount);
+
+#	if GLM_ARCH & GLM_ARCH_AVX_BIT
+		char const* Arch = "AVX";
+#	elif GLM_ARCH & GLM_ARCH_SSE2_BIT
+		char const* Arch = "SSE2";
+#	else
+		char const* Arch = "none";
+#	endif
+
+	std::printf("frustum cull %d boxes (%d visible):\n", static_cast<int>(Count), static_cast<int>(BatchCount));
+	std::printf("- scalar: %.1f Mboxes/s\n", ScalarRate / 1e6);
+	std::printf("- batch (%s): %.1f Mboxes/s, %.2fx\n", Arch, BatchRate / 1e6, BatchRate / ScalarRate);
+
+	Error += ScalarCount == BatchCount ? 0 : 1;
+	Error += ScalarVisible == BatchVisible ? 0 : 1;
+
+	return Error;
+}
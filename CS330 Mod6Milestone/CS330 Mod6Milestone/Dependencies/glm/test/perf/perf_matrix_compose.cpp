@@ -0,0 +1,79 @@
+#ifndef GLM_FORCE_INTRINSICS
+#	define GLM_FORCE_INTRINSICS
+#endif
+#include <glm/ext/matrix_compose.hpp>
+#include <glm/ext/matrix_relational.hpp>
+#include <glm/ext/quaternion_trigonometric.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <glm/geometric.hpp>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+
+static float random_float(float Min, float Max)
+{
+	return Min + (Max - Min) * static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX);
+}
+
+typedef void (*compose_func)(std::size_t, float const* const*, float const* const*, float const* const*, float*);
+
+static double launch_compose(compose_func Func, std::vector<float> const* Components, std::vector<glm::mat4>& Out, std::size_t Iterations)
+{
+	std::size_t const Count = Out.size();
+	float const* const Translation[3] = {&Components[0][0], &Components[1][0], &Components[2][0]};
+	float const* const Rotation[4] = {&Components[3][0], &Components[4][0], &Components[5][0], &Components[6][0]};
+	float const* const Scale[3] = {&Components[7][0], &Components[8][0], &Components[9][0]};
+
+	std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+	for(std::size_t i = 0; i < Iterations; ++i)
+		Func(Count, Translation, Rotation, Scale, &Out[0][0][0]);
+	std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count() / static_cast<double>(Iterations);
+}
+
+int main()
+{
+	std::size_t const Count = 100000;
+	std::size_t const Iterations = 50;
+
+	int Error = 0;
+
+	std::vector<float> Components[10];
+	for(std::size_t c = 0; c < 10; ++c)
+		Components[c].resize(Count);
+	for(std::size_t i = 0; i < Count; ++i)
+	{
+		glm::quat const R = glm::angleAxis(random_float(-3.0f, 3.0f), glm::normalize(glm::vec3(random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f), 1.0f)));
+		Components[0][i] = random_float(-10.0f, 10.0f);
+		Components[1][i] = random_float(-10.0f, 10.0f);
+		Components[2][i] = random_float(-10.0f, 10.0f);
+		Components[3][i] = R.x;
+		Components[4][i] = R.y;
+		Components[5][i] = R.z;
+		Components[6][i] = R.w;
+		Components[7][i] = Components[8][i] = Components[9][i] = random_float(0.1f, 4.0f);
+	}
+
+	std::vector<glm::mat4> ScalarOut(Count), BatchOut(Count);
+	double const ScalarTime = launch_compose(glm::composeTRSScalar, Components, ScalarOut, Iterations);
+	double const BatchTime = launch_compose(glm::composeTRS, Components, BatchOut, Iterations);
+
+#	if GLM_ARCH & GLM_ARCH_AVX_BIT
+		char const* Arch = "AVX";
+#	elif GLM_ARCH & GLM_ARCH_SSE2_BIT
+		char const* Arch = "SSE2";
+#	else
+		char const* Arch = "none";
+#	endif
+
+	std::printf("composeTRS %d matrices:\n", static_cast<int>(Count));
+	std::printf("- scalar: %.3f ms\n", ScalarTime * 1000.0);
+	std::printf("- batch (%s): %.3f ms, %.2fx\n", Arch, BatchTime * 1000.0, ScalarTime / BatchTime);
+
+	for(std::size_t i = 0; i < Count; ++i)
+		Error += glm::all(glm::equal(ScalarOut[i], BatchOut[i], 0.0001f)) ? 0 : 1;
+
+	return Error;
+}